@@ -10,33 +10,326 @@ a robot complete a playing field.
 
 // HARDWARE INPUT AND OUTPUT PIN DESIGNATIONS //
 #define LEFT_SENSOR_CHANNEL  2
+#define CENTRE_SENSOR_CHANNEL 3
 #define RIGHT_SENSOR_CHANNEL 1
+#define SENSOR_SPACING       20     // Distance between neighbouring sensors in mm.
+#define START_BUTTON         RA5    // Reads 1 while the start button is pressed.
+#define LED_PORT             PORTC
+
+// Define TELEMETRY to stream records over the EUSART. Its pins are RB5 and RB7, so two motor lines move to the top LEDs.
+// #define TELEMETRY
+// Define TRACE to send every tick's sensor readings and decisions instead, for sim/replay_trace to check. It needs the EUSART too.
+// #define TRACE
+#if defined(TRACE) && !defined(TELEMETRY)
+#define TELEMETRY
+#endif
 
 #define RIGHT_MOTOR_FORWARD  RB4
+#define LEFT_MOTOR_REVERSE   RB6
+#ifdef TELEMETRY
+#define RIGHT_MOTOR_REVERSE  RC6
+#define LEFT_MOTOR_FORWARD   RC7
+#define LED_MASK             0b00111111 // PORTC pins that drive LEDs.
+#else
 #define RIGHT_MOTOR_REVERSE  RB5
 #define LEFT_MOTOR_FORWARD   RB7
-#define LEFT_MOTOR_REVERSE   RB6
-
-// VALUES DEPENDENT ON BATTERY CHARGE AND SPEED //
-#define SENSOR_THRESHOLD     50
-#define MAX_WIDTH            15
-#define ENTER_EXIT_DELAY     750000
+#define LED_MASK             0b11111111
+#endif
+
+// VALUES DEPENDENT ON SPEED //
+// ENTER_EXIT_TIME, HYSTERESIS and WIDE_BAR_RATIO can be set when compiling, the simulator's sweep does. //
+#define DEFAULT_WHITE        20     // Reading over white used until the sensors have been calibrated.
+#define DEFAULT_BLACK        80     // Reading over black used until the sensors have been calibrated.
+#ifndef ENTER_EXIT_TIME
+#define ENTER_EXIT_TIME      375    // Time in ms to drive across a line before turning.
+#endif
+#define EXIT_TURN_TIME       1060   // Time in ms to spin from the last bar to face the perimeter about 10 degrees off square, on the destination side of the approach line.
+#define EXIT_CLEAR_TIME      800    // Time in ms to drive off the bars after that spin, before looking for the perimeter.
+
+// GUARDS //
+// Every step that moves waits for its event for at most one of these, after which the line has been missed and the step's expired row is entered.
+#define LINE_GUARD_TIME      2500   // Time in ms to drive straight onto or off a line, about 450mm.
+#define TURN_GUARD_TIME      1500   // Time in ms a turn or swing looks for a line, about 240 degrees.
+#define SECTION_GUARD_TIME   4000   // Time in ms to follow a line to the next line across it.
+#define PERIMETER_GUARD_TIME 16000  // Time in ms to follow the perimeter past the markers to a section, over half of it.
+#define ALIGN_GUARD_TIME     1000   // Time in ms to line up on the barcode approach line, which is about that long.
+#define SCAN_GUARD_TIME      1800   // Time in ms to drive over every bar from the end of the approach line, stopping well short of the far side of the field.
+
+// SUPPLY COMPENSATION //
+// The motors run off the battery the PIC does, so the wheels are driven harder as the supply drops and the speeds stay as tuned.
+#define SUPPLY_CHANNEL       0b1101 // ADC channel of the fixed 0.6V reference, so readings go up as the supply drops.
+#define SUPPLY_BATCHES       64     // Sensor batches between conversions of the reference, a power of 2.
+#define ACQUISITION_CYCLES   24     // Instruction cycles the ADC is left on a new channel before converting it, the 11.5us acquisition time.
+#define NOMINAL_SUPPLY       123    // 10 bit reading of the reference at the 5V of the fresh battery the speeds are tuned on.
+#define SUPPLY_SHIFT         4      // The supply is averaged over about 2^SUPPLY_SHIFT conversions.
+#define SUPPLY_ONE           128    // Drive scale of a fresh battery, the scale is in 1/128ths.
+
+// SENSOR CALIBRATION //
+#define MIN_CONTRAST         24     // Smallest difference between black and white accepted from a calibration.
+#ifndef HYSTERESIS
+#define HYSTERESIS           4      // Half the width of the band between the colours in 1/16ths of the contrast.
+#endif
+#define EEPROM_LEVELS        0x00   // White then black level of each sensor, in enum Sensor order.
+#define EEPROM_LEVELS_KEY    0x06   // Holds LEVELS_KEY once levels have been saved.
+#define LEVELS_KEY           0xA5
+#define EEPROM_PROFILE       0x07   // Learned length of each perimeter segment, low byte first, 0xFFFF until one has been learned.
+
+// SENSOR FILTERING //
+// Every sample is filtered by the ADC interrupt before anything sees it, so one noisy sample cannot count a marker or end a bar.
+#define FILTER_NONE          0
+#define FILTER_AVERAGE       1      // Mean of the last FILTER_LENGTH samples.
+#define FILTER_MEDIAN        2      // Median of the last 3 samples.
+#define FILTER_DEBOUNCE      3      // A sample across the hysteresis band is only passed on once FILTER_LENGTH in a row have crossed it.
+#ifndef SENSOR_FILTER
+#define SENSOR_FILTER        FILTER_AVERAGE
+#endif
+#define FILTER_LENGTH        4      // Samples averaged, a power of 2, or samples in a row a debounced crossing takes.
+
+// BARCODE //
+// Comparator C1 compares the right sensor on C12IN0- with CVREF in the middle of the band, so a bar edge is stamped the moment it happens.
+// The edge only counts once the filtered reading has crossed the band too, so noise on the comparator cannot add one.
+#define NUM_BARS             5      // Lines in the barcode, the first one is always narrow.
+#define COMPARATOR_SETUP     0b10010100 // C1 on, output inverted so it is 1 over black, CVREF against C12IN0- on RA1.
+#define REFERENCE_ON         0b10010000 // VRCON with CVREF on for C1 and the 0.6V reference on for the supply.
+#define REFERENCE_LOW_RANGE  0b00100000 // VRR, CVREF in steps of VDD/24 from 0 rather than VDD/32 from VDD/4.
+#ifndef WIDE_BAR_RATIO
+#define WIDE_BAR_RATIO       2      // A bar that takes this many times as long to cross as the first one is a wide bar.
+#endif
+
+// PLAYING FIELD //
+#define PERIMETER_LENGTH     4400   // Length in mm of the perimeter line the sections are reached from, 1600 by 600mm.
+#define NUM_DESTINATIONS     4      // Destinations a barcode can encode.
+
+// MOTOR SPEEDS AND LINE FOLLOWING GAINS //
+#define MAX_SPEED            100    // Wheel speed at full duty, speeds are in % of full duty.
+#define CRUISE_SPEED         90     // Wheel speed while following the line.
+#define SPRINT_SPEED         100    // Wheel speed on the part of a learned segment well before its end. Full duty, so a sprint is at most 11% faster than CRUISE_SPEED.
+#define SPRINT_SHARE         12     // Part of a learned segment sprinted in 1/16ths, the rest is at CRUISE_SPEED.
+#define PROFILE_SHIFT        6      // Segment lengths are stored in units of 64 speed ms.
+#define PROFILE_UNKNOWN      0xFFFF // Stored length of a segment that has not been learned.
+#define LINE_MIN_DARKNESS    4      // Total darkness of the array below which the line is lost, in 1/16ths of a sensor over black.
+#define CORNER_TICKS         150    // Ticks the perimeter is lost for at a corner before the axle is about over it and the robot turns into it, about 25mm.
+#define LINE_MAX_DARKNESS    20     // Total darkness above which a second line is under the array, a single line darkens at most one sensor.
+#define LINE_KP              24     // Proportional gain in 1/16ths.
+#define LINE_KI              2      // Integral gain in 1/16ths of the error summed over 64ms.
+#define LINE_KD              64     // Derivative gain in 1/16ths.
+#define INTEGRAL_LIMIT       4096   // Largest magnitude of the summed error.
+#define ALIGN_TOLERANCE      2      // Largest line position in mm either side of the centre the robot counts as lined up.
+#define ALIGN_TICKS          100    // Ticks in a row the line must stay within ALIGN_TOLERANCE, about 17mm of travel.
+
+// BOOT //
+// self_test() runs at power up with the robot on the start spot, the centre sensor over the home line and the outer ones either side of it. //
+#define MOTOR_PULSE_TIME     30     // Time in ms each wheel is pulsed either way by the self test.
+#define START_PAUSE_TIME     250    // Time in ms between the start button and the robot moving, for the hand to clear it.
+#define ADC_FAULT            0b00001000 // LED lit by the self test if the ADC stopped, the ones below it are each sensor misreading the start spot.
+#define WHITE_FLOOR_SHIFT    2      // A sensor reading below its white level shifted right by this, a quarter of it, is a dead or open channel.
+
+// POWER //
+// The PIC sleeps between control ticks while idle, woken by the start button or the watchdog. //
+#define WAKE_PRESCALER       0b1010 // Watchdog prescaler of 1:32768 of the 31kHz LFINTOSC, a wake about every 1s.
+#define WAKE_TIME            1057   // Time in ms the watchdog takes to wake the PIC at that prescaler.
+
+// INSTRUMENTATION //
+// Define LATENCY_HISTOGRAM to time every control tick with Timer1. It costs a few us per tick and 16 bytes of RAM.
+// #define LATENCY_HISTOGRAM
+#define LATENCY_BUCKETS      8      // Buckets of the step time histogram, each twice as wide as the one before.
+#define LATENCY_FIRST_BUCKET 64     // Width of the first bucket in Timer1 counts of 0.5us.
+#define LATENCY_MAX_SHIFT    3      // Longest steps are kept in Timer1 counts >> this, 4us steps up to the 1ms tick.
+#define LATENCY_SHOW_TIME    1000   // Time in ms each frame of the histogram is shown on PORTC while idle.
+
+// TELEMETRY //
+#define TELEMETRY_PERIOD     10     // Time in ms between records.
+#define TELEMETRY_BRG        34     // Baud rate generator value for 57600 baud at 8MHz with BRG16 and BRGH set.
+#define TELEMETRY_SYNC       0xA5   // First byte of every record.
+#define TELEMETRY_RECORD     10     // Bytes in a record.
+#define TX_BUFFER_SIZE       32     // Bytes in the transmit ring buffer, a power of 2.
+#define TX_SLOT(i)           tx_buffer[(i) & (TX_BUFFER_SIZE - 1)] // Byte i of the ring buffer, with i wrapped round its size.
+
+// TRACE //
+// The trace starts with TRACE_SYNC and the first TRACE_EEPROM_SIZE bytes of EEPROM, then has a record for every tick.
+// A record is a byte of TRACE_ flags followed by the values they mark, in the order of the flags.
+#define TRACE_BRG            16     // Baud rate generator value for 117647 baud, a tick takes about 6 bytes.
+#define TRACE_SYNC           0xA6   // First byte of the trace.
+#define TRACE_EEPROM_SIZE    19     // EEPROM bytes sent at the start, the levels, their key and the segment lengths.
+#define TRACE_READINGS       0x07   // Bit i set if the reading of sensor i changed, followed by the change or TRACE_ESCAPE and the reading.
+#define TRACE_INPUTS         0x08   // The start button is pressed or the supply scale changed, followed by a byte of TRACE_INPUT_ flags and the values they mark.
+#define TRACE_MOTORS         0x10   // The wheel speeds changed, followed by the right and left speed.
+#define TRACE_STEP           0x20   // The step changed, followed by the new step.
+#define TRACE_EDGES          0x40   // Barcode edges were captured, followed by the edge count and the high then low byte of every new edge.
+#define TRACE_TICKS          0x80   // Other than 1 tick passed since the last record, followed by the number of ticks.
+#define TRACE_ESCAPE         0x80   // Marks a reading sent in full because the change would not fit in a signed byte.
+#define TRACE_INPUT_BUTTON   0x01   // The start button is pressed, no value follows.
+#define TRACE_INPUT_SUPPLY   0x02   // supply_scale changed, followed by the new scale.
+#define TRACE_MAX_EDGES      2      // Edges sent in one record, any more wait for the next one.
+#define TRACE_RECORD         (8 + 2 * NUM_SENSORS + 2 * TRACE_MAX_EDGES) // Longest record.
 
 __CONFIG( FOSC_INTRCIO & WDTE_OFF & PWRTE_OFF & MCLRE_OFF & CP_OFF & CPD_OFF & BOREN_OFF & IESO_OFF & FCMEN_OFF );
 
-enum Sensor {RIGHT_SENSOR, LEFT_SENSOR}; // Arguments that will determine which sensor is read.
+enum Sensor {RIGHT_SENSOR, CENTRE_SENSOR, LEFT_SENSOR, NUM_SENSORS}; // Arguments that will determine which sensor is read, from right to left.
 enum Direction {RIGHT, LEFT};            // Arguments that will determine which direction the robot is travelling around the field.
+enum Timer {MOTION_TIMER, NUM_TIMERS};   // Software timers counted down by the control tick.
+
+// MISSION STATE MACHINE //
+// The near side is the side the robot is travelling towards and the far side is the opposite one.
+// FOLLOW follows the perimeter and times its segments, FOLLOW_SPUR follows a spur line inside it (the home line and the barcode approach line) at the speed the perimeter was left at.
+enum Phase {WAITING, STARTING, ENTERING, ADJUSTING, SCANNING, DELIVERING, RETURNING, NUM_PHASES};
+enum Action {NO_ACTION, RESET, BEGIN, CALIBRATE, CAPTURE, COUNT_BARS, DECODE, PLAN_NEXT, PLAN_HOME, SHOW_FAULT};
+enum Motion {STOP, FORWARD, REVERSE, TURN_NEAR, TURN_FAR, SWING_FAR, FOLLOW, FOLLOW_SPUR};
+enum Event {BUTTON, TIMEOUT, NEAR_BLACK, NEAR_WHITE, FAR_BLACK, FAR_WHITE, CENTRE_BLACK, BOTH_BLACK, ALL_WHITE, ALIGNED, MARKERS, BARS, BARCODE, LAST_STOP};
+enum Step
+{
+    IDLE, START_PAUSE,
+    START_LINE, START_CROSS, LEAVE_LINE, LEAVE_CROSS, LEAVE_TURN, LEAVE_TURN_LINE, LEAVE_CENTRE, START_MARKERS,
+    ENTER_BARCODE,
+    ALIGN_CROSS, ALIGN_TURN, ALIGN_TURN_LINE, ALIGN_CENTRE, ALIGN_LINE, ALIGN_END,
+    SCAN_BARS, RESCAN_BACK, RESCAN_GAP, RESCAN_END, RESCAN_BARS,
+    EXIT_TURN, EXIT_CLEAR, EXIT_LINE, EXIT_CROSS, EXIT_JOIN, EXIT_JOIN_LINE, EXIT_CENTRE, GO_MARKERS, DOCK_CROSS, DOCK_CLEAR, DOCK_TURN, DOCK_SWING, DOCK_PAUSE, UNDOCK_BACK, UNDOCK_CROSS,
+    NEXT_STOP, NEXT_TURN, NEXT_TURN_LINE, NEXT_CENTRE,
+    HOME_TURN, HOME_TURN_LINE, HOME_CENTRE, HOME_MARKERS, HOME_ENTER, HOME_CROSS, HOME_DOCK, HOME_DOCK_LINE, HOME_DOCK_CENTRE, HOME_PARK,
+    FAULT,
+    NUM_STEPS
+};
+
+struct Transition
+{
+    unsigned char phase;   // enum Phase the step belongs to.
+    unsigned char action;  // enum Action done once when the step is entered.
+    unsigned char motion;  // enum Motion applied on every tick of the step.
+    unsigned char event;   // enum Event that ends the step.
+    unsigned int time;     // Time in ms loaded into MOTION_TIMER, that a TIMEOUT event waits for and any other event must occur within.
+    unsigned char next;    // enum Step entered when the event occurs.
+    unsigned char expired; // enum Step entered when the time runs out before the event, next for a TIMEOUT event.
+};
+
+// A LAST_STOP step is a decision, it leaves on its first tick, to next if the event has occurred and otherwise to the row below. //
+// A step with no time waits for its event for ever, and names itself as expired. //
+
+// Rows are in enum Step order. //
+const struct Transition mission [NUM_STEPS] =
+{
+    // phase     action            motion        event         time                  next               expired
+    {WAITING,    RESET,            STOP,         BUTTON,       0,                    START_PAUSE,       IDLE},              // IDLE
+    {WAITING,    NO_ACTION,        STOP,         TIMEOUT,      START_PAUSE_TIME,     START_LINE,        START_LINE},        // START_PAUSE
+
+    {STARTING,   BEGIN,            FOLLOW_SPUR,  BOTH_BLACK,   LINE_GUARD_TIME,      START_CROSS,       FAULT},             // START_LINE
+    {STARTING,   NO_ACTION,        FOLLOW_SPUR,  NEAR_WHITE,   LINE_GUARD_TIME,      LEAVE_LINE,        FAULT},             // START_CROSS
+    {STARTING,   NO_ACTION,        FOLLOW_SPUR,  BOTH_BLACK,   LINE_GUARD_TIME,      LEAVE_CROSS,       FAULT},             // LEAVE_LINE
+    {STARTING,   NO_ACTION,        FORWARD,      TIMEOUT,      ENTER_EXIT_TIME,      LEAVE_TURN,        LEAVE_TURN},        // LEAVE_CROSS
+    {STARTING,   NO_ACTION,        TURN_NEAR,    NEAR_WHITE,   TURN_GUARD_TIME,      LEAVE_TURN_LINE,   FAULT},             // LEAVE_TURN
+    {STARTING,   NO_ACTION,        TURN_NEAR,    NEAR_BLACK,   TURN_GUARD_TIME,      LEAVE_CENTRE,      FAULT},             // LEAVE_TURN_LINE
+    {STARTING,   NO_ACTION,        TURN_NEAR,    CENTRE_BLACK, TURN_GUARD_TIME,      START_MARKERS,     FAULT},             // LEAVE_CENTRE
+    {STARTING,   CALIBRATE,        FOLLOW,       MARKERS,      PERIMETER_GUARD_TIME, ENTER_BARCODE,     FAULT},             // START_MARKERS
+
+    {ENTERING,   NO_ACTION,        FOLLOW,       BOTH_BLACK,   SECTION_GUARD_TIME,   ALIGN_CROSS,       FAULT},             // ENTER_BARCODE
+
+    {ADJUSTING,  NO_ACTION,        FORWARD,      TIMEOUT,      ENTER_EXIT_TIME,      ALIGN_TURN,        ALIGN_TURN},        // ALIGN_CROSS
+    {ADJUSTING,  NO_ACTION,        TURN_NEAR,    NEAR_WHITE,   TURN_GUARD_TIME,      ALIGN_TURN_LINE,   FAULT},             // ALIGN_TURN
+    {ADJUSTING,  NO_ACTION,        TURN_NEAR,    NEAR_BLACK,   TURN_GUARD_TIME,      ALIGN_CENTRE,      FAULT},             // ALIGN_TURN_LINE
+    {ADJUSTING,  NO_ACTION,        TURN_NEAR,    CENTRE_BLACK, TURN_GUARD_TIME,      ALIGN_LINE,        FAULT},             // ALIGN_CENTRE
+    {ADJUSTING,  NO_ACTION,        FOLLOW_SPUR,  ALIGNED,      ALIGN_GUARD_TIME,     ALIGN_END,         ALIGN_END},         // ALIGN_LINE
+    {ADJUSTING,  NO_ACTION,        FOLLOW_SPUR,  ALL_WHITE,    LINE_GUARD_TIME,      SCAN_BARS,         FAULT},             // ALIGN_END
+
+    {SCANNING,   CAPTURE,          FORWARD,      BARCODE,      SCAN_GUARD_TIME,      EXIT_TURN,         RESCAN_BACK},       // SCAN_BARS
+    {SCANNING,   COUNT_BARS,       REVERSE,      BARS,         LINE_GUARD_TIME,      RESCAN_GAP,        FAULT},             // RESCAN_BACK
+    {SCANNING,   NO_ACTION,        REVERSE,      ALL_WHITE,    LINE_GUARD_TIME,      RESCAN_END,        FAULT},             // RESCAN_GAP
+    {SCANNING,   NO_ACTION,        REVERSE,      CENTRE_BLACK, LINE_GUARD_TIME,      RESCAN_BARS,       FAULT},             // RESCAN_END
+    {SCANNING,   CAPTURE,          FORWARD,      BARCODE,      SCAN_GUARD_TIME,      EXIT_TURN,         FAULT},             // RESCAN_BARS
+
+    {DELIVERING, DECODE,           TURN_FAR,     TIMEOUT,      EXIT_TURN_TIME,       EXIT_CLEAR,        EXIT_CLEAR},        // EXIT_TURN
+    {DELIVERING, NO_ACTION,        FORWARD,      TIMEOUT,      EXIT_CLEAR_TIME,      EXIT_LINE,         EXIT_LINE},         // EXIT_CLEAR
+    {DELIVERING, NO_ACTION,        FORWARD,      BOTH_BLACK,   LINE_GUARD_TIME,      EXIT_CROSS,        FAULT},             // EXIT_LINE
+    {DELIVERING, NO_ACTION,        FORWARD,      TIMEOUT,      ENTER_EXIT_TIME,      EXIT_JOIN,         EXIT_JOIN},         // EXIT_CROSS
+    {DELIVERING, NO_ACTION,        TURN_NEAR,    NEAR_WHITE,   TURN_GUARD_TIME,      EXIT_JOIN_LINE,    FAULT},             // EXIT_JOIN
+    {DELIVERING, NO_ACTION,        TURN_NEAR,    NEAR_BLACK,   TURN_GUARD_TIME,      EXIT_CENTRE,       FAULT},             // EXIT_JOIN_LINE
+    {DELIVERING, NO_ACTION,        TURN_NEAR,    CENTRE_BLACK, TURN_GUARD_TIME,      GO_MARKERS,        FAULT},             // EXIT_CENTRE
+    {DELIVERING, NO_ACTION,        FOLLOW,       MARKERS,      PERIMETER_GUARD_TIME, DOCK_CROSS,        FAULT},             // GO_MARKERS
+    {DELIVERING, NO_ACTION,        FORWARD,      TIMEOUT,      ENTER_EXIT_TIME,      DOCK_CLEAR,        DOCK_CLEAR},        // DOCK_CROSS
+    {DELIVERING, NO_ACTION,        TURN_FAR,     FAR_WHITE,    TURN_GUARD_TIME,      DOCK_TURN,         FAULT},             // DOCK_CLEAR
+    {DELIVERING, NO_ACTION,        TURN_FAR,     FAR_BLACK,    TURN_GUARD_TIME,      DOCK_SWING,        FAULT},             // DOCK_TURN
+    {DELIVERING, NO_ACTION,        SWING_FAR,    NEAR_BLACK,   TURN_GUARD_TIME,      DOCK_PAUSE,        FAULT},             // DOCK_SWING
+    {DELIVERING, NO_ACTION,        STOP,         TIMEOUT,      1000,                 UNDOCK_BACK,       UNDOCK_BACK},       // DOCK_PAUSE
+    {DELIVERING, NO_ACTION,        REVERSE,      BOTH_BLACK,   LINE_GUARD_TIME,      UNDOCK_CROSS,      FAULT},             // UNDOCK_BACK
+    {DELIVERING, NO_ACTION,        FORWARD,      TIMEOUT,      ENTER_EXIT_TIME,      NEXT_STOP,         NEXT_STOP},         // UNDOCK_CROSS
+    {DELIVERING, NO_ACTION,        STOP,         LAST_STOP,    0,                    HOME_TURN,         NEXT_STOP},         // NEXT_STOP
+    {DELIVERING, PLAN_NEXT,        TURN_NEAR,    NEAR_WHITE,   TURN_GUARD_TIME,      NEXT_TURN_LINE,    FAULT},             // NEXT_TURN
+    {DELIVERING, NO_ACTION,        TURN_NEAR,    NEAR_BLACK,   TURN_GUARD_TIME,      NEXT_CENTRE,       FAULT},             // NEXT_TURN_LINE
+    {DELIVERING, NO_ACTION,        TURN_NEAR,    CENTRE_BLACK, TURN_GUARD_TIME,      GO_MARKERS,        FAULT},             // NEXT_CENTRE
+
+    {RETURNING,  PLAN_HOME,        TURN_NEAR,    NEAR_WHITE,   TURN_GUARD_TIME,      HOME_TURN_LINE,    FAULT},             // HOME_TURN
+    {RETURNING,  NO_ACTION,        TURN_NEAR,    NEAR_BLACK,   TURN_GUARD_TIME,      HOME_CENTRE,       FAULT},             // HOME_TURN_LINE
+    {RETURNING,  NO_ACTION,        TURN_NEAR,    CENTRE_BLACK, TURN_GUARD_TIME,      HOME_MARKERS,      FAULT},             // HOME_CENTRE
+    {RETURNING,  NO_ACTION,        FOLLOW,       MARKERS,      PERIMETER_GUARD_TIME, HOME_ENTER,        FAULT},             // HOME_MARKERS
+    {RETURNING,  NO_ACTION,        FOLLOW,       BOTH_BLACK,   PERIMETER_GUARD_TIME, HOME_CROSS,        FAULT},             // HOME_ENTER
+    {RETURNING,  NO_ACTION,        FORWARD,      TIMEOUT,      ENTER_EXIT_TIME,      HOME_DOCK,         HOME_DOCK},         // HOME_CROSS
+    {RETURNING,  NO_ACTION,        TURN_NEAR,    NEAR_WHITE,   TURN_GUARD_TIME,      HOME_DOCK_LINE,    FAULT},             // HOME_DOCK
+    {RETURNING,  NO_ACTION,        TURN_NEAR,    NEAR_BLACK,   TURN_GUARD_TIME,      HOME_DOCK_CENTRE,  FAULT},             // HOME_DOCK_LINE
+    {RETURNING,  NO_ACTION,        TURN_NEAR,    CENTRE_BLACK, TURN_GUARD_TIME,      HOME_PARK,         FAULT},             // HOME_DOCK_CENTRE
+    {RETURNING,  NO_ACTION,        FOLLOW_SPUR,  BOTH_BLACK,   SECTION_GUARD_TIME,   IDLE,              FAULT},             // HOME_PARK
+
+    {WAITING,    SHOW_FAULT,       STOP,         BUTTON,       0,                    IDLE,              FAULT}              // FAULT
+};
+
+// PLAYING FIELD //
+// Sections in clockwise order around the perimeter. Travelling RIGHT goes clockwise, with the far sensor outside the perimeter.
+enum Section {HOME_SECTION, DEST1_SECTION, DEST3_SECTION, BARCODE_SECTION, DEST2_SECTION, DEST0_SECTION, NUM_SECTIONS};
+
+struct Junction
+{
+    unsigned int position; // Distance in mm clockwise along the perimeter from the top left corner.
+    unsigned char marker;  // 1 if the section has a line outside the perimeter the far sensor counts.
+};
+
+// Where each section joins the perimeter in mm clockwise from home, rows are in enum Section order. Home faces the barcode across the field, //
+// so destinations 0 and 2 are reached clockwise from the barcode and go on round to home, and destinations 1 and 3 the other way. //
+// They only pick the way round and the order of the stops, the markers counted come from the order of the sections and their marker column. //
+const struct Junction field [NUM_SECTIONS] =
+{
+    // position marker
+    {0,         1},  // HOME_SECTION
+    {1500,      1},  // DEST1_SECTION
+    {1750,      1},  // DEST3_SECTION
+    {2000,      1},  // BARCODE_SECTION
+    {2250,      1},  // DEST2_SECTION
+    {2500,      1}   // DEST0_SECTION
+};
+
+const unsigned char destination_section [NUM_DESTINATIONS] = {DEST0_SECTION, DEST1_SECTION, DEST2_SECTION, DEST3_SECTION};
 
 // INITIALIZATION FUNCTIONS //
 void init_hardware(void);
-void reset_barcode_width(void);
+unsigned char self_test(void);
+void load_levels(void);
+void save_levels(void);
+void load_profile(void);
+void save_profile(void);
+void set_thresholds(void);
+
+// TIMING FUNCTIONS //
+void init_timer(void);
+void start_timer(enum Timer timer, unsigned int time);
+char timer_expired(enum Timer timer);
+void wait(unsigned int time);
+void wait_tick(void);
+unsigned int motion_time(unsigned int time);
+unsigned int sleep_idle(void);
 
 // SENSOR COMPUTING FUNCTIONS //
-int get_sensor(enum Sensor side);
-char black(int reading);
-char white(int reading);
+void init_sensors(void);
+unsigned char reference_setting(unsigned char level);
+void start_capture(void);
+void stop_capture(void);
+unsigned char filter_sample(enum Sensor side, unsigned char reading);
+void read_sensors(void);
+void check_supply(void);
+void update_colour(enum Sensor side, unsigned char reading);
+unsigned char darkness(enum Sensor side);
+int line_position(void);
+char black(enum Sensor side);
+char white(enum Sensor side);
 
 // MOVEMENT FUNCTIONS //
+void set_motors(int right, int left);
+void follow_line(int error, int speed);
 void stop(void);
 void forward(void);
 void reverse(void);
@@ -44,32 +337,129 @@ void turn_left(void);
 void turn_right(void);
 void swing_right(void);
 void swing_left(void);
-void reverse_right(void);
-void reverse_left(void);
 void test(void);
-void drive_right(void);
-void drive_left(void);
+void move(enum Motion motion);
+
+// INSTRUMENTATION FUNCTIONS //
+unsigned int timer1_now(void);
+void record_latency(unsigned int start);
+void show_latency(unsigned int time);
+void init_telemetry(void);
+char queue_bytes(const unsigned char *bytes, unsigned char count);
+void send_telemetry(void);
+void init_trace(void);
+void send_trace(void);
+void set_leds(unsigned char leds);
 
 // ROUTINE FUNCTIONS //
-void count_marker(enum Direction direction);
-void start(void);
-void leave(enum Direction direction);
-void enter(enum Direction direction);
-void adjust_position(void);
-void scan_barcode(void);
-void go_to_destination(unsigned char destination);
-void dock(enum Direction direction);
-void go_home(unsigned char destination);
+void step_mission(void);
+void enter_step(unsigned char next);
+void do_action(enum Action action);
+char check_event(enum Event event);
+char count_edge(enum Sensor side);
+char aligned(void);
+unsigned char wide_bars(void);
+unsigned int clockwise_distance(unsigned char from, unsigned char to);
+unsigned int route_distance(unsigned char from, unsigned char to);
+void order_stops(unsigned char stops);
+void plan_route(unsigned char from, unsigned char to, char stop_on_marker);
+unsigned char next_section(unsigned char section);
+void start_segment(void);
+void time_segment(void);
 
 // VARIABLE DECLARTIONS //
-unsigned int left_sensor = 0;                    // Stores the value of the last reading from the left light sensor.
-unsigned int right_sensor = 0;                   // Stores the value of the last reading from the right light sensor.
+const unsigned char sensor_channel [NUM_SENSORS] = {RIGHT_SENSOR_CHANNEL, CENTRE_SENSOR_CHANNEL, LEFT_SENSOR_CHANNEL}; // Analogue channel of each sensor.
+const signed char sensor_offset [NUM_SENSORS] = {SENSOR_SPACING, 0, -SENSOR_SPACING}; // Distance of each sensor right of the centre of the robot in mm.
+unsigned char readings [NUM_SENSORS];            // Last batch of readings copied from the ADC interrupt, indexed by enum Sensor.
+unsigned char white_level [NUM_SENSORS] = {DEFAULT_WHITE, DEFAULT_WHITE, DEFAULT_WHITE}; // Reading of each sensor over white.
+unsigned char black_level [NUM_SENSORS] = {DEFAULT_BLACK, DEFAULT_BLACK, DEFAULT_BLACK}; // Reading of each sensor over black.
+unsigned char learned_white [NUM_SENSORS];       // Lowest readings seen by the calibration in progress.
+unsigned char learned_black [NUM_SENSORS];       // Highest readings seen by the calibration in progress.
+unsigned char low_threshold [NUM_SENSORS];       // A sensor over black reads white again once it drops below this.
+unsigned char high_threshold [NUM_SENSORS];      // A sensor over white reads black once it rises above this.
+char sensor_black [NUM_SENSORS];                 // Colour each sensor has last crossed into.
+char calibrating = 0;                            // Set while the start sequence is learning the sensor levels.
+int last_position = 0;                           // Line position of the last tick the line was seen on.
+unsigned char lost_ticks = 0;                    // Ticks in a row line_position() has found the array off the line.
+char cornering = 0;                              // Set while a FOLLOW step turns into a corner of the perimeter.
+volatile unsigned char samples [2][NUM_SENSORS]; // Double buffer of sensor batches filled by the ADC interrupt.
+volatile unsigned char sample_front = 0;         // Index of the buffer holding the latest complete batch.
+volatile unsigned char sample_sequence = 0;      // Incremented by the ADC interrupt every time a new batch is published.
+unsigned char sample_side = 0;                   // enum Sensor the ADC is currently converting, or NUM_SENSORS for the supply. Only used by the interrupt.
+volatile unsigned int supply_reading = 0;        // Latest 10 bit conversion of the 0.6V reference, set by the ADC interrupt.
+volatile unsigned char supply_sequence = 0;      // Incremented by the ADC interrupt with every conversion of the reference.
+unsigned char supply_checked = 0;                // supply_sequence when check_supply() last took a reading.
+unsigned int supply_level = 0;                   // Average of the supply readings << SUPPLY_SHIFT, 0 until the first one.
+unsigned char supply_scale = SUPPLY_ONE;         // Factor the wheel speeds are driven at to make up for a drained battery.
+#if SENSOR_FILTER == FILTER_AVERAGE
+unsigned char filter_history [NUM_SENSORS][FILTER_LENGTH]; // Last samples of each sensor. Only used by the interrupt.
+unsigned char filter_index = 0;                  // Column of filter_history the next batch of samples goes in.
+unsigned int filter_sum [NUM_SENSORS];           // Sum of each row of filter_history.
+#elif SENSOR_FILTER == FILTER_MEDIAN
+unsigned char filter_history [NUM_SENSORS][2];   // Two samples before the latest of each sensor, newest first. Only used by the interrupt.
+#elif SENSOR_FILTER == FILTER_DEBOUNCE
+unsigned char filter_output [NUM_SENSORS];       // Last sample of each sensor passed on. Only used by the interrupt.
+char filter_black [NUM_SENSORS];                 // Colour of filter_output, with the same hysteresis as update_colour().
+unsigned char filter_count [NUM_SENSORS];        // Samples in a row that have crossed the hysteresis band.
+#endif
+volatile unsigned int timers [NUM_TIMERS];       // Time in ms left on each software timer.
+volatile signed char right_speed = 0;            // Speed of the right wheel from -MAX_SPEED to MAX_SPEED, output by the Timer2 interrupt.
+volatile signed char left_speed = 0;             // Speed of the left wheel from -MAX_SPEED to MAX_SPEED, output by the Timer2 interrupt.
+volatile signed char right_drive = 0;            // Duty the Timer2 interrupt drives the right wheel at, right_speed scaled for the supply.
+volatile signed char left_drive = 0;             // Duty the Timer2 interrupt drives the left wheel at.
+unsigned char right_duty = 0;                    // Duty accumulator of the right wheel. Only used by the interrupt.
+unsigned char left_duty = 0;                     // Duty accumulator of the left wheel. Only used by the interrupt.
+int line_integral = 0;                           // Sum of the line following error.
+int last_error = 0;                              // Line following error of the previous tick.
+volatile char tick_pending = 0;                  // Set by the Timer2 interrupt every 1ms to release the next mission step.
+unsigned char step = IDLE;                       // Current row of the mission state machine.
+unsigned char phase = WAITING;                   // enum Phase of the current step, kept for debugging and the simulator.
+unsigned char fault_step = IDLE;                 // Last step whose time ran out before its event, shown on the LEDs by FAULT.
+enum Direction direction = RIGHT;                // Direction the robot is travelling around the field.
+char last_black = 0;                             // Last colour seen by the sensor whose edges are being counted.
+unsigned char aligned_ticks = 0;                 // Ticks in a row the line has been within ALIGN_TOLERANCE of the centre.
 signed char marker_count = 0;                    // Keeps track of how many markers or sections have been passed.
 signed char markers_to_destination = 0;          // Determines how many markers the robot must pass to reach its destination.
-signed char barcode = 0;                         // Keeps track of how many barcode lines have been read.
-signed char width = 0;                           // Stores the width of a line before it is sent to the array for storage.
 unsigned char destination = 0;                   // Stores the destination in which the robot must travel to.
-signed char barcode_width [5] = {0, 0, 0, 0, 0}; // Stores the widths of the lines read.
+unsigned char route [NUM_DESTINATIONS];          // Destinations of the barcode in the order they are visited.
+unsigned char route_length = 0;                  // Destinations in route.
+unsigned char next_stop = 0;                     // Index in route of the destination visited after the current one.
+unsigned char route_section = HOME_SECTION;       // Section the robot last passed on the perimeter, or the one it joined it at.
+unsigned int segment_length [NUM_SECTIONS];      // Learned length of the segment from each section to the next one clockwise, in speed ms >> PROFILE_SHIFT.
+unsigned long segment_progress = 0;              // Sum of the follow speed of every tick since the segment began.
+char segment_whole = 0;                          // Set once the segment being timed began at a section, rather than part way along.
+char segment_black = 0;                          // Last colour of the far sensor seen while timing segments.
+char profile_changed = 0;                        // Set when a segment length has been learned that is not saved yet.
+char levels_changed = 0;                         // Set when the sensor levels have been calibrated but not saved yet.
+int follow_speed = CRUISE_SPEED;                 // Speed the line is followed at on this tick.
+volatile unsigned int bar_edges [2 * NUM_BARS];  // Timer1 time of every barcode line edge under the right sensor, counted by the ADC interrupt.
+volatile unsigned char edge_count = 0;           // Edges in bar_edges, odd while the right sensor is over a line.
+volatile char capturing = 0;                     // Set while barcode edges are being timestamped.
+volatile unsigned int edge_time = 0;             // Timer1 time the right sensor last crossed CVREF towards the colour of the next edge, set by the comparator interrupt.
+volatile unsigned char timer1_overflows = 0;     // Upper byte of the barcode edge times, counted by the Timer1 interrupt.
+#ifdef LATENCY_HISTOGRAM
+unsigned char latency_counts [LATENCY_BUCKETS];  // Control ticks whose step took the time of each bucket, all halved when one fills.
+unsigned char latency_max [NUM_PHASES];          // Longest step of each phase in Timer1 counts >> LATENCY_MAX_SHIFT.
+unsigned char latency_overruns = 0;              // Steps that were still running when the next tick came.
+#endif
+#ifdef TELEMETRY
+unsigned char tx_buffer [TX_BUFFER_SIZE];        // Ring buffer of bytes waiting to be sent.
+volatile unsigned char tx_head = 0;              // Index the next byte is queued at. Only written by send_telemetry().
+volatile unsigned char tx_tail = 0;              // Index of the next byte to send. Only written by the interrupt.
+unsigned char telemetry_sequence = 0;            // Number of the next record, counting dropped ones.
+unsigned char telemetry_ticks = 0;               // Ticks since the last record.
+#endif
+#ifdef TRACE
+volatile unsigned char trace_ticks = 0;          // Ticks counted by the Timer2 interrupt since wait_tick() last took them.
+unsigned char trace_elapsed = 0;                 // Ticks that passed before the current step.
+char tracing = 0;                                // Set while the trace is being sent, cleared for good if a record did not fit.
+unsigned char trace_readings [NUM_SENSORS];      // Readings sent so far.
+signed char trace_right = 0;                     // Wheel speeds sent so far.
+signed char trace_left = 0;
+unsigned char trace_step = IDLE;                 // Step sent so far.
+unsigned char trace_edges = 0;                   // Barcode edges sent so far.
+unsigned char trace_supply = SUPPLY_ONE;         // Supply scale sent so far.
+#endif
 
 
 // ========================= MAIN ========================= //
@@ -79,47 +469,70 @@ void main(void)
     OSCCONbits.IRCF = 0b111; // Set clock speed to 8MHz.
     OSCCONbits.SCS = 1;      // Use internal oscillator for system clock.
 
+    init_timer();
     init_hardware();
-
-    TRISA = 0b00110110; // Set pins AN1 and AN2 on the A register to inputs for the sensors.
-
-    ANSEL = 0b00000110;  // Set pins AN1 and AN2 to analogue inputs.
-    ADCON0 = 0b00000001; // Turn on the ADC.
+    init_sensors();
+    load_levels();
+    load_profile();
+#ifdef TELEMETRY
+    init_telemetry();
+#endif
+#ifdef TRACE
+    init_trace();
+#endif
 
     stop();
+    enter_step(IDLE);
 
-    while((RA5 == 0))
-    {
-        // ======= PROGRAM INITIALIZATION =======//
-        left_sensor = 0;
-        right_sensor = 0;
-        marker_count = 0;
-        barcode = 0;
-        width = 0;
-        destination = 0;
-        reset_barcode_width();
-
-        PORTC = 0;
-
-        left_sensor = get_sensor(LEFT_SENSOR);
-        right_sensor = get_sensor(RIGHT_SENSOR);
-
-        while (RA5 == 0);
-        _delay(2000000);
+    // The LEDs stay dark unless the self test found a fault, which is shown until the first mission. //
+    unsigned char faults = self_test();
 
-        // ================ START =============== //
+    set_leds(faults);
 
-        start();
+#ifdef LATENCY_HISTOGRAM
+    unsigned int slept = 0; // Time in ms the PIC slept before this tick.
+#endif
 
-        enter(RIGHT);
-        adjust_position();
+    while (1)
+    {
+        wait_tick();
 
-        scan_barcode();
+#ifdef LATENCY_HISTOGRAM
+        unsigned int start = timer1_now();
 
-        go_to_destination(destination);
-        go_home(destination);
+        step_mission();
 
-        // ================= END ================ //
+        // Idle ticks would swamp the histogram, so the LEDs show it instead, once any fault has been seen. //
+        if (step == IDLE)
+        {
+            if (!faults)
+            {
+                show_latency(slept + 1);
+            }
+        }
+        else
+        {
+            faults = 0;
+            record_latency(start);
+        }
+#else
+        step_mission();
+#endif
+
+#ifdef TRACE
+        send_trace();
+#elif defined(TELEMETRY)
+        send_telemetry();
+#endif
+
+#ifdef LATENCY_HISTOGRAM
+        slept = (step == IDLE) ? sleep_idle() : 0;
+#else
+        if (step == IDLE)
+        {
+            sleep_idle();
+        }
+#endif
     }
 }
 
@@ -128,734 +541,2119 @@ void main(void)
 // ========================= METHODS ========================= //
 
 
+#ifdef LATENCY_HISTOGRAM
 /* ================================
-Function: go_home
-Paramaters: unsigned char destination
-return type: none
-Description: Drives robot back to
-start from current location.
+Function: timer1_now
+Paramaters: none
+return type: unsigned int
+Description: Returns the 16 bit
+Timer1 count in 0.5us steps. Reads
+the high byte again in case the low
+byte rolled over into it.
 ================================ */
-void go_home(unsigned char destination)
+unsigned int timer1_now(void)
 {
-    switch (destination)
-    {
-        case 0:
-            turn_right();
-            while (black(get_sensor(RIGHT_SENSOR)));
-            while (white(get_sensor(RIGHT_SENSOR)));
-
-            enter(RIGHT);
-
-            forward();
-            _delay(ENTER_EXIT_DELAY);
-
-            while (white(get_sensor(RIGHT_SENSOR)))
-            {
-                turn_right();
-            }
-
-            break;
-
-        case 1:
-            turn_left();
-            while (black(get_sensor(LEFT_SENSOR)));
-            while (white(get_sensor(LEFT_SENSOR)));
-
-            enter(LEFT);
-
-            forward();
-            _delay(ENTER_EXIT_DELAY);
-
-            while (white(get_sensor(LEFT_SENSOR)))
-            {
-                turn_left();
-            }
-
-            break;
-
-        case 2:
-            turn_right();
-            while (black(get_sensor(RIGHT_SENSOR)));
-            while (white(get_sensor(RIGHT_SENSOR)));
-
-            marker_count = 0;
-            while (marker_count < 1)
-            {
-                drive_right();
-                count_marker(RIGHT);
-            }
-
-            enter(RIGHT);
-
-            forward();
-            _delay(ENTER_EXIT_DELAY);
-
-            while (white(get_sensor(RIGHT_SENSOR)))
-            {
-                turn_right();
-            }
-
-            break;
-
-        case 3:
-            turn_left();
-            while (black(get_sensor(LEFT_SENSOR)));
-            while (white(get_sensor(LEFT_SENSOR)));
-
-            marker_count = 0;
-            while (marker_count < 1)
-            {
-                drive_left();
-                count_marker(LEFT);
-            }
-
-            enter(LEFT);
-
-            forward();
-            _delay(ENTER_EXIT_DELAY);
-
-            while (white(get_sensor(LEFT_SENSOR)))
-            {
-                turn_left();
-            }
-
-            break;
+    unsigned char high;
+    unsigned char low;
 
-        default:
-            break;
-    }
+    do
+    {
+        high = TMR1H;
+        low = TMR1L;
+    } while (high != TMR1H);
 
-    stop();
+    return ((unsigned int)high << 8) | low;
 }
 
 /* ================================
-Function: dock
-Paramaters: enum Direction direction
+Function: record_latency
+Paramaters: unsigned int start
 return type: none
-Description: Instructions for the
-robot to turn into the destination.
+Description: Adds the time since the
+Timer1 count given to the histogram
+and the longest step of the current
+phase. The counts are halved together
+when one fills, which keeps their
+shares. A step still running when the
+next tick has come counts as an
+overrun, since that tick is late.
 ================================ */
-void dock(enum Direction direction)
+void record_latency(unsigned int start)
 {
-    if (direction == RIGHT)
-    {
-        forward();
+    unsigned int busy = (timer1_now() - start) & 0xFFFF; // Timer1 wraps at 16 bits.
+    unsigned int width = LATENCY_FIRST_BUCKET;
+    unsigned char bucket = 0;
 
-        _delay(ENTER_EXIT_DELAY);
-
-        while (white(get_sensor(RIGHT_SENSOR)))
-        {
-            turn_right();
-        }
+    while (busy >= width && bucket < LATENCY_BUCKETS - 1)
+    {
+        width <<= 1;
+        bucket++;
+    }
 
-        while (white(get_sensor(LEFT_SENSOR)))
+    if (latency_counts[bucket] == 0xFF)
+    {
+        for (unsigned char i = 0; i < LATENCY_BUCKETS; i++)
         {
-            swing_right();
+            latency_counts[i] >>= 1;
         }
     }
-    else if (direction == LEFT)
-    {
-        forward();
 
-        _delay(ENTER_EXIT_DELAY);
+    latency_counts[bucket]++;
 
-        while (white(get_sensor(LEFT_SENSOR)))
-        {
-            turn_left();
-        }
+    busy >>= LATENCY_MAX_SHIFT;
 
-        while (white(get_sensor(RIGHT_SENSOR)))
-        {
-            swing_left();
-        }
+    if (busy > 0xFF)
+    {
+        busy = 0xFF;
+    }
+
+    if (busy > latency_max[phase])
+    {
+        latency_max[phase] = busy;
+    }
+
+    if (tick_pending && latency_overruns < 0xFF)
+    {
+        latency_overruns++;
     }
 }
 
 /* ================================
-Function: go_to_destination
-Paramaters: unsigned char destination
+Function: show_latency
+Paramaters: unsigned int time
 return type: none
-Description: Robot will drive to
-the destination read and will dock
-into the section.
+Description: Steps through the
+histogram on the PORTC LEDs while
+the robot is idle, given the time in
+ms since it was last called. The bottom 3 LEDs
+give the bucket and the ones above
+them the share of the ticks that fell
+in it, in 1/31sts or 1/7ths with
+TELEMETRY. After the last bucket one
+more frame gives the phase with the
+longest step in the bottom 3 LEDs and
+the overruns above them, capped at 31
+or 7.
 ================================ */
-void go_to_destination(unsigned char destination)
+void show_latency(unsigned int time)
 {
-    markers_to_destination = 0;
-    marker_count = 0;
-
-    switch (destination)
-    {
-        case 0:
-            reverse_left();
-            while (white(get_sensor(RIGHT_SENSOR)));
-            while (black(get_sensor(RIGHT_SENSOR)));
-            while (white(get_sensor(RIGHT_SENSOR)));
-
-            stop();
-
-            markers_to_destination = 2;
-            while (marker_count < markers_to_destination)
-            {
-                drive_right();
-                count_marker(RIGHT);
-            }
+    static unsigned int shown = 0;
+    static unsigned char bucket = 0;
+    unsigned int total = 0;
+    unsigned char share = 0;
 
-            dock(LEFT);
-            break;
-
-        case 1:
-            reverse_right();
-            while (white(get_sensor(LEFT_SENSOR)));
-            while (black(get_sensor(LEFT_SENSOR)));
-            while (white(get_sensor(LEFT_SENSOR)));
-
-            markers_to_destination = 2;
-            while (marker_count < markers_to_destination)
-            {
-                drive_left();
-                count_marker(LEFT);
-            }
+    shown += time;
 
-            dock(RIGHT);
-            break;
+    if (shown < LATENCY_SHOW_TIME)
+    {
+        return;
+    }
 
-        case 2:
-            reverse_left();
-            while (white(get_sensor(RIGHT_SENSOR)));
-            while (black(get_sensor(RIGHT_SENSOR)));
-            while (white(get_sensor(RIGHT_SENSOR)));
+    shown = 0;
+    bucket = (bucket + 1) % (LATENCY_BUCKETS + 1);
 
-            stop();
+    // The frame after the last bucket shows the worst phase and the overruns. //
+    if (bucket == LATENCY_BUCKETS)
+    {
+        unsigned char worst = 0;
 
-            markers_to_destination = 1;
-            while (marker_count < markers_to_destination)
+        for (unsigned char i = 1; i < NUM_PHASES; i++)
+        {
+            if (latency_max[i] > latency_max[worst])
             {
-                drive_right();
-                count_marker(RIGHT);
+                worst = i;
             }
+        }
 
-            dock(LEFT);
-            break;
-
-        case 3:
-            reverse_right();
-            while (white(get_sensor(LEFT_SENSOR)));
-            while (black(get_sensor(LEFT_SENSOR)));
-            while (white(get_sensor(LEFT_SENSOR)));
-
-            markers_to_destination = 1;
-            while (marker_count < markers_to_destination)
-            {
-                drive_left();
-                count_marker(LEFT);
-            }
+        share = (latency_overruns < (LED_MASK >> 3)) ? latency_overruns : (LED_MASK >> 3);
+        set_leds((share << 3) | worst);
+        return;
+    }
 
-            dock(RIGHT);
-            break;
+    for (unsigned char i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += latency_counts[i];
+    }
 
-        default:
-            break;
+    if (total > 0)
+    {
+        share = latency_counts[bucket] * (LED_MASK >> 3) / total;
     }
 
-    stop();
-    _delay(2000000);
+    set_leds((share << 3) | bucket);
 }
+#endif
 
+#ifdef TELEMETRY
 /* ================================
-Function: scan_barcode
+Function: init_telemetry
 Paramaters: none
 return type: none
-Description: Moves robot over
-barcode, calculates the correct
-destination, then exits the section.
+Description: Sets up the EUSART to
+transmit at 57600 baud, or at 117647
+baud for a trace.
 ================================ */
-void scan_barcode(void)
+void init_telemetry(void)
 {
-    while (barcode_width[1] < MAX_WIDTH && barcode_width[2] < MAX_WIDTH && barcode_width[3] < MAX_WIDTH && barcode_width[4] < MAX_WIDTH)
-    {
-        width = 0;
-        forward();
+    SPBRGH = 0;
+#ifdef TRACE
+    SPBRG = TRACE_BRG;
+#else
+    SPBRG = TELEMETRY_BRG;
+#endif
+    BAUDCTL = 0b00001000; // 16 bit baud rate generator.
+    TXSTA = 0b00100100;   // Asynchronous 8 bit transmission at high speed.
+    RCSTA = 0b10000000;   // Serial port on, taking over RB5 and RB7.
+
+    TXIE = 0; // Enabled by queue_bytes() once there is something to send.
+    PEIE = 1;
+    GIE = 1;
+}
 
-        if (black(get_sensor(RIGHT_SENSOR)))
-        {
-            while (black(get_sensor(RIGHT_SENSOR)))
-            {
-                width++;
-                barcode_width[barcode] = width;
-                _delay(10000);
-            }
+/* ================================
+Function: send_telemetry
+Paramaters: none
+return type: none
+Description: Queues a record every
+TELEMETRY_PERIOD ticks for the TX
+interrupt to send. A record is the
+sync byte, the record number, phase,
+marker_count, every sensor reading,
+both wheel speeds and the sum of the
+bytes after the sync byte. If the
+ring buffer is too full the record
+is dropped rather than waiting, and
+the gap in record numbers tells the
+decoder.
+================================ */
+void send_telemetry(void)
+{
+    unsigned char record [TELEMETRY_RECORD];
+    unsigned char sum = 0;
 
-            barcode++;
-        }
+    if (++telemetry_ticks < TELEMETRY_PERIOD)
+    {
+        return;
     }
 
-    stop();
+    telemetry_ticks = 0;
 
-    for (int i = 4; i > 0; i--)
+    record[0] = TELEMETRY_SYNC;
+    record[1] = telemetry_sequence++;
+    record[2] = phase;
+    record[3] = marker_count;
+
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
     {
-        if (barcode_width[i] > MAX_WIDTH)
-        {
-            destination = --i;
-        }
+        record[4 + i] = readings[i];
     }
 
-    PORTC = destination;
-
-    _delay(2000000);
+    record[4 + NUM_SENSORS] = right_speed;
+    record[5 + NUM_SENSORS] = left_speed;
 
-	for (int i = 0; i < destination + 2; i++)
+    for (unsigned char i = 1; i < TELEMETRY_RECORD - 1; i++)
     {
-        while (black(get_sensor(RIGHT)));
-        reverse();
-        while (white(get_sensor(RIGHT)));
+        sum += record[i];
     }
-    _delay(250000);
 
-    stop();
+    record[TELEMETRY_RECORD - 1] = sum;
+
+    queue_bytes(record, TELEMETRY_RECORD);
 }
 
 /* ================================
-Function: adjust_position
-Paramaters: none
-return type: none
-Description: Lines robot up to
-read barcode.
+Function: queue_bytes
+Paramaters: const unsigned char *bytes, unsigned char count
+return type: char
+Description: Queues the bytes given
+for the TX interrupt to send, all or
+none of them. Returns 0 if the ring
+buffer is too full, rather than
+waiting for room.
 ================================ */
-void adjust_position(void)
+char queue_bytes(const unsigned char *bytes, unsigned char count)
 {
-    forward();
-    _delay(ENTER_EXIT_DELAY);
-
-    turn_right();
-    while (white(get_sensor(RIGHT_SENSOR)));
+    unsigned char head = tx_head;
 
-    forward();
-    while (white(get_sensor(RIGHT_SENSOR)) && white(get_sensor(LEFT_SENSOR)));
+    // One byte is always left free so a full buffer can be told from an empty one. //
+    if (((tx_tail - head - 1) & (TX_BUFFER_SIZE - 1)) < count)
+    {
+        return 0;
+    }
 
-    swing_right();
-    while (white(get_sensor(LEFT_SENSOR)));
+    for (unsigned char i = 0; i < count; i++)
+    {
+        tx_buffer[head] = bytes[i];
+        head = (head + 1) & (TX_BUFFER_SIZE - 1);
+    }
 
-    swing_left();
-    while (white(get_sensor(RIGHT_SENSOR)));
+    tx_head = head; // Publishes all the bytes to the interrupt at once.
+    TXIE = 1;
 
-	stop();
-    _delay(1000000);
+    return 1;
+}
+#endif
 
-    reverse_right();
-	while (black(get_sensor(LEFT_SENSOR)));
+#ifdef TRACE
+/* ================================
+Function: init_trace
+Paramaters: none
+return type: none
+Description: Starts the trace with
+the EEPROM the levels and segment
+lengths were just loaded from, so a
+replay starts from the same state as
+the robot did at power up.
+================================ */
+void init_trace(void)
+{
+    unsigned char header [1 + TRACE_EEPROM_SIZE];
 
-    stop();
-	_delay(1000000);
+    header[0] = TRACE_SYNC;
 
-    reverse_left();
-    while (white(get_sensor(LEFT_SENSOR)));
+    for (unsigned char i = 0; i < TRACE_EEPROM_SIZE; i++)
+    {
+        header[1 + i] = eeprom_read(i);
+    }
 
-	stop();
-    _delay(1000000);
+    tracing = queue_bytes(header, sizeof(header));
 }
 
 /* ================================
-Function: enter
-Paramaters: enum Direction direction
+Function: send_trace
+Paramaters: none
 return type: none
-Description: Moves robot into
-a section either from the right or
-left depending on the argument given.
+Description: Queues the record of
+the tick just stepped: what the
+mission read, and the step and wheel
+speeds it decided on where they
+changed. Readings are sent as the
+change since the last record. The
+record is written straight into the
+ring buffer after the bytes already
+queued, so the buffer must have room
+for the longest one. A lack of room
+ends the trace, since a replay cannot
+carry on past a gap.
 ================================ */
-void enter(enum Direction direction)
+void send_trace(void)
 {
-    if (direction == RIGHT)
-    {
-        while (1)
-        {
-            drive_right();
+    unsigned char start = tx_head; // Slot of the flags byte, the rest of the record follows it.
+    unsigned char length = 1;
+    unsigned char flags = 0;
+    unsigned char inputs = 0;
+    unsigned char edges = edge_count;
 
-            left_sensor = get_sensor(LEFT_SENSOR);
-            right_sensor = get_sensor(RIGHT_SENSOR);
+    if (!tracing)
+    {
+        return;
+    }
 
-            if (left_sensor > SENSOR_THRESHOLD && right_sensor > SENSOR_THRESHOLD)
-            {
-                return;
-            }
-        }
+    if (((tx_tail - start - 1) & (TX_BUFFER_SIZE - 1)) < TRACE_RECORD)
+    {
+        tracing = 0;
+        return;
+    }
 
+    if (trace_elapsed != 1)
+    {
+        flags |= TRACE_TICKS;
+        TX_SLOT(start + length++) = trace_elapsed;
     }
-    else if (direction == LEFT)
+
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
     {
-        while (1)
-        {
-            drive_left();
+        int change = readings[i] - trace_readings[i];
 
-            left_sensor = get_sensor(LEFT_SENSOR);
-            right_sensor = get_sensor(RIGHT_SENSOR);
+        if (change != 0)
+        {
+            flags |= 1 << i;
 
-            if (left_sensor > SENSOR_THRESHOLD && right_sensor > SENSOR_THRESHOLD)
+            if (change >= -127 && change <= 127)
+            {
+                TX_SLOT(start + length++) = change;
+            }
+            else
             {
-                return;
+                TX_SLOT(start + length++) = TRACE_ESCAPE;
+                TX_SLOT(start + length++) = readings[i];
             }
+
+            trace_readings[i] = readings[i];
         }
     }
-}
-
-/* ================================
-Function: leave
-Paramaters: enum Direction direction
-return type: none
-Description: Moves robot out of
-starting section either right or
-left depending on the argument given.
-================================ */
-void leave(enum Direction direction)
-{
-    forward();
 
-    right_sensor = get_sensor(RIGHT_SENSOR);
-    left_sensor = get_sensor(LEFT_SENSOR);
-    while (white(right_sensor) && white(left_sensor))
+    if (START_BUTTON == 1)
     {
-        right_sensor = get_sensor(RIGHT_SENSOR);
-        left_sensor = get_sensor(LEFT_SENSOR);
+        inputs |= TRACE_INPUT_BUTTON;
     }
 
-    _delay(ENTER_EXIT_DELAY);
-
-    if (direction == RIGHT)
+    // The wheel speeds follow from the supply scale, so a replay needs it to decide on the same ones. //
+    if (supply_scale != trace_supply)
     {
-        turn_right();
-        while (white(get_sensor(RIGHT_SENSOR)));
+        inputs |= TRACE_INPUT_SUPPLY;
+        trace_supply = supply_scale;
     }
-    else if (direction == LEFT)
+
+    if (inputs)
     {
-        turn_left();
-        while (white(get_sensor(LEFT_SENSOR)));
-    }
-}
+        flags |= TRACE_INPUTS;
+        TX_SLOT(start + length++) = inputs;
 
-/* ================================
-Function: start
-Paramaters: none
-return type: none
-Description: Drives robot to the
-entrance of the barcode.
-================================ */
-void start(void)
-{
-    forward();
-    while (white(get_sensor(RIGHT_SENSOR)));
-    while (black(get_sensor(RIGHT_SENSOR)));
+        if (inputs & TRACE_INPUT_SUPPLY)
+        {
+            TX_SLOT(start + length++) = trace_supply;
+        }
+    }
 
-    leave(RIGHT);
+    if (right_speed != trace_right || left_speed != trace_left)
+    {
+        flags |= TRACE_MOTORS;
+        trace_right = right_speed;
+        trace_left = left_speed;
+        TX_SLOT(start + length++) = trace_right;
+        TX_SLOT(start + length++) = trace_left;
+    }
 
-    markers_to_destination = 2;
+    if (step != trace_step)
+    {
+        flags |= TRACE_STEP;
+        trace_step = step;
+        TX_SLOT(start + length++) = step;
+    }
 
-    while (marker_count < markers_to_destination)
+    // The count drops back when a new barcode capture starts. //
+    if (edges < trace_edges)
     {
-        drive_right();
-        count_marker(RIGHT);
+        trace_edges = 0;
     }
-}
 
-/* ================================
-Function: counter_marker
-Paramaters: enum Direction direction
-return type: none
-Description: Counts the number of
-parking spots on the outside of the
-playing field.
-================================ */
-void count_marker(enum Direction direction)
-{
-    if (direction == RIGHT)
+    if (edges != trace_edges)
     {
-        if (black(get_sensor(LEFT_SENSOR)))
+        if (edges > trace_edges + TRACE_MAX_EDGES)
         {
-            marker_count++;
-            while(black(get_sensor(LEFT_SENSOR)))
-            {
-                drive_right();
-            }
+            edges = trace_edges + TRACE_MAX_EDGES;
         }
-    }
-    else if (direction == LEFT)
-    {
-        if (black(get_sensor(RIGHT_SENSOR)))
+
+        flags |= TRACE_EDGES;
+        TX_SLOT(start + length++) = edges;
+
+        for (; trace_edges < edges; trace_edges++)
         {
-            marker_count++;
-            while(black(get_sensor(RIGHT_SENSOR)))
-            {
-                drive_left();
-            }
+            TX_SLOT(start + length++) = bar_edges[trace_edges] >> 8;
+            TX_SLOT(start + length++) = bar_edges[trace_edges] & 0xFF;
         }
     }
+
+    TX_SLOT(start) = flags;
+    tx_head = (start + length) & (TX_BUFFER_SIZE - 1); // Publishes the whole record to the interrupt at once.
+    TXIE = 1;
 }
+#endif
 
 /* ================================
-Function: drive_left
-Paramaters: none
+Function: set_leds
+Paramaters: unsigned char leds
 return type: none
-Description: Makes the robot follow
-a line moving counterclockwise.
+Description: Shows the pattern given
+on the PORTC LEDs, leaving any motor
+lines on PORTC alone.
 ================================ */
-void drive_left(void)
+void set_leds(unsigned char leds)
 {
-    left_sensor = get_sensor(LEFT_SENSOR);
-    right_sensor = get_sensor(RIGHT_SENSOR);
-
-    if (left_sensor > SENSOR_THRESHOLD)
-    {
-        turn_left();
-    }
-    else if (right_sensor < SENSOR_THRESHOLD && left_sensor < SENSOR_THRESHOLD)
-    {
-        forward();
-    }
+#ifdef TELEMETRY
+    TMR2IE = 0; // The tick must not change the motor lines between reading and writing PORTC.
+    LED_PORT = (LED_PORT & ~LED_MASK) | (leds & LED_MASK);
+    TMR2IE = 1;
+#else
+    LED_PORT = leds;
+#endif
 }
 
 /* ================================
-Function: drive_right
+Function: step_mission
 Paramaters: none
 return type: none
-Description: Makes the robot follow
-a line moving clockwise.
+Description: Runs one control tick
+of the mission. Moves to the next
+step if the event the current step
+waits for has occurred, or to its
+expired step if its time ran out
+first, then applies the motion of
+the current step.
 ================================ */
-void drive_right(void)
+void step_mission(void)
 {
-    left_sensor = get_sensor(LEFT_SENSOR);
-    right_sensor = get_sensor(RIGHT_SENSOR);
+    read_sensors();
+    check_supply();
 
-    if (right_sensor > SENSOR_THRESHOLD)
+    if (mission[step].motion == FOLLOW)
     {
-        turn_right();
+        time_segment();
     }
-    else if (right_sensor < SENSOR_THRESHOLD && left_sensor < SENSOR_THRESHOLD)
+
+    if (check_event(mission[step].event))
+    {
+        enter_step(mission[step].next);
+    }
+    else if (mission[step].event == LAST_STOP)
+    {
+        enter_step(step + 1);
+    }
+    else if (mission[step].time != 0 && timer_expired(MOTION_TIMER))
     {
-        forward();
+        fault_step = step;
+        enter_step(mission[step].expired);
     }
+
+    move(mission[step].motion);
 }
 
 /* ================================
-Function: reverse_right
-Paramaters: none
+Function: enter_step
+Paramaters: unsigned char next
 return type: none
-Description: Moves right motor
-backwards.
+Description: Makes the step given
+the current one, doing its action
+and starting its timer.
 ================================ */
-void reverse_right(void)
+void enter_step(unsigned char next)
 {
-    RIGHT_MOTOR_FORWARD = 0;
-    RIGHT_MOTOR_REVERSE = 1;
-    LEFT_MOTOR_FORWARD = 0;
-    LEFT_MOTOR_REVERSE = 0;
+    // Consecutive FOLLOW steps are one stretch of the perimeter. //
+    if (mission[next].motion == FOLLOW && mission[step].motion != FOLLOW)
+    {
+        start_segment();
+    }
+
+    step = next;
+    phase = mission[step].phase;
+    last_black = 0;
+    aligned_ticks = 0;
+    line_integral = 0;
+    last_error = 0;
+
+    do_action(mission[step].action);
+
+    if (mission[step].time != 0)
+    {
+        start_timer(MOTION_TIMER, (mission[step].motion == STOP) ? mission[step].time : motion_time(mission[step].time));
+    }
 }
 
 /* ================================
-Function: reverse_left
-Paramaters: none
+Function: do_action
+Paramaters: enum Action action
 return type: none
-Description: Moves left motor
-backwards.
+Description: Updates the routine
+variables when a step is entered.
 ================================ */
-void reverse_left(void)
+void do_action(enum Action action)
 {
-    RIGHT_MOTOR_FORWARD = 0;
-    RIGHT_MOTOR_REVERSE = 0;
-    LEFT_MOTOR_FORWARD = 0;
-    LEFT_MOTOR_REVERSE = 1;
-}
+    switch (action)
+    {
+        case RESET:
+            stop();
 
-/* ================================
-Function: swing_right
-Paramaters: none
-return type: none
+            marker_count = 0;
+            stop_capture();
+            edge_count = 0;
+            destination = 0;
+            route_length = 0;
+            next_stop = 0;
+
+            // The robot is parked, so the stall of the EEPROM writes does no harm. //
+            if (levels_changed)
+            {
+                save_levels();
+            }
+
+            if (profile_changed)
+            {
+                save_profile();
+            }
+
+            set_leds(0);
+            break;
+
+        case BEGIN:
+            plan_route(HOME_SECTION, BARCODE_SECTION, 0);
+
+            // Every sensor crosses both colours on the way over the gate line and the turn onto the perimeter. //
+            for (unsigned char i = 0; i < NUM_SENSORS; i++)
+            {
+                learned_white[i] = readings[i];
+                learned_black[i] = readings[i];
+            }
+
+            calibrating = 1;
+            break;
+
+        case CALIBRATE:
+            calibrating = 0;
+
+            for (unsigned char i = 0; i < NUM_SENSORS; i++)
+            {
+                if (learned_black[i] < learned_white[i] + MIN_CONTRAST)
+                {
+                    return;
+                }
+            }
+
+            for (unsigned char i = 0; i < NUM_SENSORS; i++)
+            {
+                white_level[i] = learned_white[i];
+                black_level[i] = learned_black[i];
+            }
+
+            set_thresholds();
+
+            // The robot is moving, so the levels are saved once it is parked. //
+            levels_changed = 1;
+            break;
+
+        case CAPTURE:
+            start_capture();
+            break;
+
+        // After a bad pass the centre sensor counts the bars on the way back over them to the end of the approach line. //
+        case COUNT_BARS:
+            stop_capture();
+            marker_count = 0;
+            markers_to_destination = NUM_BARS;
+            break;
+
+        // The bars are decoded as soon as the forward pass has read them, the robot turns off them without reversing. //
+        case DECODE:
+            stop_capture();
+            order_stops(wide_bars());
+            destination = route[0];
+            next_stop = 1;
+            plan_route(BARCODE_SECTION, destination_section[destination], 1);
+
+            set_leds(destination);
+            break;
+
+        case PLAN_NEXT:
+            plan_route(destination_section[destination], destination_section[route[next_stop]], 1);
+            destination = route[next_stop++];
+
+            set_leds(destination);
+            break;
+
+        case PLAN_HOME:
+            plan_route(destination_section[destination], HOME_SECTION, 0);
+            break;
+
+        // The robot has lost the line, so it stops where it is and shows the step that lost it until the button is pressed. //
+        case SHOW_FAULT:
+            stop_capture();
+            set_leds(fault_step);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* ================================
+Function: check_event
+Paramaters: enum Event event
+return type: char
+Description: Returns 1 if the event
+given has occurred on this tick.
+================================ */
+char check_event(enum Event event)
+{
+    enum Sensor near = (direction == RIGHT) ? RIGHT_SENSOR : LEFT_SENSOR;
+    enum Sensor far = (direction == RIGHT) ? LEFT_SENSOR : RIGHT_SENSOR;
+
+    switch (event)
+    {
+        case BUTTON:
+            return START_BUTTON == 1;
+
+        case TIMEOUT:
+            return timer_expired(MOTION_TIMER);
+
+        case NEAR_BLACK:
+            return black(near);
+
+        case NEAR_WHITE:
+            return white(near);
+
+        case FAR_BLACK:
+            return black(far);
+
+        case FAR_WHITE:
+            return white(far);
+
+        case CENTRE_BLACK:
+            return black(CENTRE_SENSOR);
+
+        case BOTH_BLACK:
+            return black(near) && black(far);
+
+        case ALL_WHITE:
+            return white(near) && white(CENTRE_SENSOR) && white(far);
+
+        case ALIGNED:
+            return aligned();
+
+        case MARKERS:
+            return count_edge(far);
+
+        case BARS:
+            return count_edge(CENTRE_SENSOR);
+
+        case BARCODE:
+            return wide_bars() != 0;
+
+        case LAST_STOP:
+            return next_stop >= route_length;
+
+        default:
+            return 0;
+    }
+}
+
+/* ================================
+Function: count_edge
+Paramaters: enum Sensor side
+return type: char
+Description: Counts the lines the
+sensor given moves onto and returns
+1 once markers_to_destination have
+been passed.
+================================ */
+char count_edge(enum Sensor side)
+{
+    if (black(side) && !last_black)
+    {
+        marker_count++;
+    }
+
+    last_black = black(side);
+
+    return marker_count >= markers_to_destination;
+}
+
+/* ================================
+Function: aligned
+Paramaters: none
+return type: char
+Description: Measures how far the
+line is off the centre of the array
+and returns 1 once it has stayed
+within ALIGN_TOLERANCE for
+ALIGN_TICKS ticks in a row. A line
+that stays centred while the robot
+drives along it is lined up in
+heading as well as position.
+================================ */
+char aligned(void)
+{
+    int error = line_position();
+
+    if (error > ALIGN_TOLERANCE || error < -ALIGN_TOLERANCE)
+    {
+        aligned_ticks = 0;
+    }
+    else if (aligned_ticks < ALIGN_TICKS)
+    {
+        aligned_ticks++;
+    }
+
+    return aligned_ticks >= ALIGN_TICKS;
+}
+
+/* ================================
+Function: wide_bars
+Paramaters: none
+return type: unsigned char
+Description: Returns the destinations
+the barcode encodes once every bar
+has been crossed, or 0 until then.
+Bit i is set if bar i + 1 took at
+least WIDE_BAR_RATIO times as long
+to cross as the first one. Comparing
+times rather than counting samples
+makes the result independent of the
+speed.
+================================ */
+unsigned char wide_bars(void)
+{
+    unsigned int first;
+    unsigned char stops = 0;
+
+    if (edge_count < 2 * NUM_BARS)
+    {
+        return 0;
+    }
+
+    first = (bar_edges[1] - bar_edges[0]) & 0xFFFF; // Edge times wrap at 16 bits.
+
+    for (unsigned char i = 1; i < NUM_BARS; i++)
+    {
+        if (((bar_edges[2 * i + 1] - bar_edges[2 * i]) & 0xFFFF) >= WIDE_BAR_RATIO * first)
+        {
+            stops |= 1 << (i - 1);
+        }
+    }
+
+    return stops;
+}
+
+/* ================================
+Function: clockwise_distance
+Paramaters: unsigned char from, unsigned char to
+return type: unsigned int
+Description: Returns the distance in
+mm clockwise along the perimeter from
+the first section given to the other.
+================================ */
+unsigned int clockwise_distance(unsigned char from, unsigned char to)
+{
+    unsigned int clockwise = field[to].position - field[from].position;
+
+    if (field[to].position < field[from].position)
+    {
+        clockwise += PERIMETER_LENGTH;
+    }
+
+    return clockwise;
+}
+
+/* ================================
+Function: route_distance
+Paramaters: unsigned char from, unsigned char to
+return type: unsigned int
+Description: Returns the distance in
+mm the way round the perimeter
+plan_route() picks between the two
+sections given.
+================================ */
+unsigned int route_distance(unsigned char from, unsigned char to)
+{
+    unsigned int clockwise = clockwise_distance(from, to);
+
+    return (clockwise <= PERIMETER_LENGTH / 2) ? clockwise : PERIMETER_LENGTH - clockwise;
+}
+
+/* ================================
+Function: order_stops
+Paramaters: unsigned char stops
+return type: none
+Description: Fills route with the
+destinations set in the mask given
+in the order that makes the trip
+from the barcode round all of them
+and back home shortest. There are at
+most 24 orders, so every one is
+tried, numbering them by which of
+the destinations left is picked for
+each stop.
+================================ */
+void order_stops(unsigned char stops)
+{
+    unsigned char wanted [NUM_DESTINATIONS];
+    unsigned char orders = 1;
+    unsigned int best = 0xFFFF;
+
+    route_length = 0;
+
+    for (unsigned char i = 0; i < NUM_DESTINATIONS; i++)
+    {
+        if (stops & (1 << i))
+        {
+            wanted[route_length++] = i;
+            orders *= route_length;
+        }
+    }
+
+    for (unsigned char order = 0; order < orders; order++)
+    {
+        unsigned char left [NUM_DESTINATIONS];
+        unsigned char trip [NUM_DESTINATIONS];
+        unsigned char choice = order;
+        unsigned char from = BARCODE_SECTION;
+        unsigned int length = 0;
+
+        for (unsigned char i = 0; i < route_length; i++)
+        {
+            left[i] = wanted[i];
+        }
+
+        for (unsigned char i = 0; i < route_length; i++)
+        {
+            unsigned char count = route_length - i;
+            unsigned char pick = choice % count;
+
+            choice /= count;
+            trip[i] = left[pick];
+
+            // Close the gap so the destinations still to be picked stay together. //
+            for (unsigned char j = pick; j + 1 < count; j++)
+            {
+                left[j] = left[j + 1];
+            }
+
+            length += route_distance(from, destination_section[trip[i]]);
+            from = destination_section[trip[i]];
+        }
+
+        length += route_distance(from, HOME_SECTION);
+
+        if (length < best)
+        {
+            best = length;
+
+            for (unsigned char i = 0; i < route_length; i++)
+            {
+                route[i] = trip[i];
+            }
+        }
+    }
+}
+
+/* ================================
+Function: plan_route
+Paramaters: unsigned char from, unsigned char to, char stop_on_marker
+return type: none
+Description: Picks the shorter way
+round the perimeter between the two
+sections given and sets direction and
+markers_to_destination for it. The
+markers of the sections passed on the
+way are counted, plus the marker of
+the section given last if the robot
+is to stop on it.
+================================ */
+void plan_route(unsigned char from, unsigned char to, char stop_on_marker)
+{
+    unsigned int clockwise = clockwise_distance(from, to);
+    unsigned char section = from;
+
+    direction = (clockwise <= PERIMETER_LENGTH / 2) ? RIGHT : LEFT;
+    route_section = from;
+    marker_count = 0;
+    markers_to_destination = (stop_on_marker && field[to].marker) ? 1 : 0;
+
+    while (1)
+    {
+        section = next_section(section);
+
+        if (section == to)
+        {
+            break;
+        }
+
+        markers_to_destination += field[section].marker;
+    }
+}
+
+/* ================================
+Function: next_section
+Paramaters: unsigned char section
+return type: unsigned char
+Description: Returns the section
+after the one given in the direction
+the robot is travelling.
+================================ */
+unsigned char next_section(unsigned char section)
+{
+    if (direction == RIGHT)
+    {
+        return (section + 1 == NUM_SECTIONS) ? 0 : section + 1;
+    }
+
+    return (section == 0) ? NUM_SECTIONS - 1 : section - 1;
+}
+
+/* ================================
+Function: start_segment
+Paramaters: none
+return type: none
+Description: Starts timing the
+perimeter from route_section when
+the robot begins following it. The
+robot has already turned part way
+along the first segment, so that one
+is not learned.
+================================ */
+void start_segment(void)
+{
+    segment_progress = 0;
+    segment_whole = 0;
+    segment_black = 0;
+}
+
+/* ================================
+Function: time_segment
+Paramaters: none
+return type: none
+Description: Picks the follow speed
+for this tick and adds it to the
+progress along the segment. Every
+section has a line outside the
+perimeter, so the far sensor moving
+onto one ends the segment, whose
+length is learned if it was followed
+from end to end. A learned segment is
+sprinted until SPRINT_SHARE of it has
+been covered, so the robot is back at
+CRUISE_SPEED before the marker.
+Progress is counted in speed rather
+than time so a sprint does not upset
+the lengths learned.
+================================ */
+void time_segment(void)
+{
+    enum Sensor far = (direction == RIGHT) ? LEFT_SENSOR : RIGHT_SENSOR;
+    unsigned char next = next_section(route_section);
+    unsigned char segment = (direction == RIGHT) ? route_section : next;
+
+    if (black(far) && !segment_black)
+    {
+        if (segment_whole && segment_length[segment] != (unsigned int)(segment_progress >> PROFILE_SHIFT))
+        {
+            segment_length[segment] = segment_progress >> PROFILE_SHIFT;
+            profile_changed = 1;
+        }
+
+        route_section = next;
+        segment_progress = 0;
+        segment_whole = 1;
+
+        next = next_section(route_section);
+        segment = (direction == RIGHT) ? route_section : next;
+    }
+
+    segment_black = black(far);
+
+    if (segment_length[segment] != PROFILE_UNKNOWN &&
+        (segment_progress >> PROFILE_SHIFT) < (unsigned long)segment_length[segment] * SPRINT_SHARE / 16)
+    {
+        follow_speed = SPRINT_SPEED;
+    }
+    else
+    {
+        follow_speed = CRUISE_SPEED;
+    }
+
+    segment_progress += follow_speed;
+}
+
+/* ================================
+Function: move
+Paramaters: enum Motion motion
+return type: none
+Description: Drives the motors for
+the motion given, using the travel
+direction for the near and far sides.
+================================ */
+void move(enum Motion motion)
+{
+    int position;
+
+    switch (motion)
+    {
+        case FORWARD:
+            forward();
+            break;
+
+        case REVERSE:
+            reverse();
+            break;
+
+        case TURN_NEAR:
+            if (direction == RIGHT)
+            {
+                turn_right();
+            }
+            else
+            {
+                turn_left();
+            }
+            break;
+
+        case TURN_FAR:
+            if (direction == RIGHT)
+            {
+                turn_left();
+            }
+            else
+            {
+                turn_right();
+            }
+            break;
+
+        case SWING_FAR:
+            if (direction == RIGHT)
+            {
+                swing_left();
+            }
+            else
+            {
+                swing_right();
+            }
+            break;
+
+        // The perimeter only ever bends the way the robot is going round it, so a line still lost once the axle has reached it is a corner, //
+        // which is turned into until the centre sensor is back on the line. //
+        case FOLLOW:
+            position = line_position();
+
+            if (lost_ticks >= CORNER_TICKS)
+            {
+                cornering = 1;
+            }
+            else if (black(CENTRE_SENSOR))
+            {
+                cornering = 0;
+            }
+
+            if (!cornering)
+            {
+                follow_line(position, follow_speed);
+            }
+            else if (direction == RIGHT)
+            {
+                turn_right();
+            }
+            else
+            {
+                turn_left();
+            }
+            break;
+
+        case FOLLOW_SPUR:
+            follow_line(line_position(), follow_speed);
+            break;
+
+        default:
+            stop();
+            break;
+    }
+}
+
+/* ================================
+Function: follow_line
+Paramaters: int error, int speed
+return type: none
+Description: PID controller that
+steers the robot right for a positive
+error and left for a negative one
+while driving at the speed given.
+================================ */
+void follow_line(int error, int speed)
+{
+    int output;
+
+    line_integral += error;
+
+    if (line_integral > INTEGRAL_LIMIT)
+    {
+        line_integral = INTEGRAL_LIMIT;
+    }
+    else if (line_integral < -INTEGRAL_LIMIT)
+    {
+        line_integral = -INTEGRAL_LIMIT;
+    }
+
+    output = (LINE_KP * error + LINE_KI * (line_integral / 64) + LINE_KD * (error - last_error)) / 16;
+    last_error = error;
+
+    if (output > 2 * MAX_SPEED)
+    {
+        output = 2 * MAX_SPEED;
+    }
+    else if (output < -2 * MAX_SPEED)
+    {
+        output = -2 * MAX_SPEED;
+    }
+
+    set_motors(speed - output, speed + output);
+}
+
+/* ================================
+Function: swing_right
+Paramaters: none
+return type: none
 Description: Moves left motor
 forward.
 ================================ */
-void swing_right(void)
+void swing_right(void)
+{
+    set_motors(0, MAX_SPEED);
+}
+
+/* ================================
+Function: swing_left
+Paramaters: none
+return type: none
+Description: Moves right motor
+forward.
+================================ */
+void swing_left(void)
+{
+    set_motors(MAX_SPEED, 0);
+}
+
+/* ================================
+Function: turn_right
+Paramaters: none
+return type: none
+Description: Moves left motor
+forward and right motor backwards.
+================================ */
+void turn_right(void)
+{
+    set_motors(-MAX_SPEED, MAX_SPEED);
+}
+
+/* ================================
+Function: turn_left
+Paramaters: none
+return type: none
+Description: Moves right motor
+forward and left motor backwards.
+================================ */
+void turn_left(void)
+{
+    set_motors(MAX_SPEED, -MAX_SPEED);
+}
+
+/* ================================
+Function: stop
+Paramaters: none
+return type: none
+Description: Stops both motors.
+================================ */
+void stop(void)
+{
+    set_motors(0, 0);
+}
+
+/* ================================
+Function: forward
+Paramaters: none
+return type: none
+Description: Moves motors forward.
+================================ */
+void forward(void)
+{
+    set_motors(MAX_SPEED, MAX_SPEED);
+}
+
+/* ================================
+Function: reverse
+Paramaters: none
+return type: none
+Description: Reverses both motors.
+================================ */
+void reverse(void)
+{
+    set_motors(-MAX_SPEED, -MAX_SPEED);
+}
+
+/* ================================
+Function: set_motors
+Paramaters: int right, int left
+return type: none
+Description: Sets the speed of each
+wheel from -MAX_SPEED (full reverse)
+to MAX_SPEED (full forward). The
+speeds are scaled for the supply and
+turned into duty cycles on the motor
+pins by the Timer2 interrupt.
+================================ */
+void set_motors(int right, int left)
+{
+    int right_scaled;
+    int left_scaled;
+
+    if (right > MAX_SPEED)
+    {
+        right = MAX_SPEED;
+    }
+    else if (right < -MAX_SPEED)
+    {
+        right = -MAX_SPEED;
+    }
+
+    if (left > MAX_SPEED)
+    {
+        left = MAX_SPEED;
+    }
+    else if (left < -MAX_SPEED)
+    {
+        left = -MAX_SPEED;
+    }
+
+    right_speed = right;
+    left_speed = left;
+
+    right_scaled = (right * supply_scale) / SUPPLY_ONE;
+    left_scaled = (left * supply_scale) / SUPPLY_ONE;
+
+    // A drained battery cannot be driven past full duty. //
+    if (right_scaled > MAX_SPEED)
+    {
+        right_scaled = MAX_SPEED;
+    }
+    else if (right_scaled < -MAX_SPEED)
+    {
+        right_scaled = -MAX_SPEED;
+    }
+
+    if (left_scaled > MAX_SPEED)
+    {
+        left_scaled = MAX_SPEED;
+    }
+    else if (left_scaled < -MAX_SPEED)
+    {
+        left_scaled = -MAX_SPEED;
+    }
+
+    right_drive = right_scaled;
+    left_drive = left_scaled;
+}
+
+/* ================================
+Function: test
+Paramaters: none
+return type: none
+Description: Test function for
+testing new code before implementing.
+================================ */
+void test(void)
+{
+    // PUT TEST CODE HERE
+}
+
+/* ================================
+Function: black
+Paramaters: enum Sensor side
+return type: char
+Description: Returns 1 if sensor
+reads black.
+================================ */
+char black(enum Sensor side)
+{
+    return sensor_black[side];
+}
+
+/* ================================
+Function: white
+Paramaters: enum Sensor side
+return type: char
+Description: Returns 1 if sensor
+reads white.
+================================ */
+char white(enum Sensor side)
+{
+    return !sensor_black[side];
+}
+
+/* ================================
+Function: update_colour
+Paramaters: enum Sensor side, unsigned char reading
+return type: none
+Description: Changes the colour of
+the sensor given once its reading
+has crossed the whole hysteresis
+band, so readings that chatter
+around the middle are not taken as
+edges.
+================================ */
+void update_colour(enum Sensor side, unsigned char reading)
+{
+    if (sensor_black[side])
+    {
+        if (reading < low_threshold[side])
+        {
+            sensor_black[side] = 0;
+        }
+    }
+    else if (reading > high_threshold[side])
+    {
+        sensor_black[side] = 1;
+    }
+}
+
+/* ================================
+Function: darkness
+Paramaters: enum Sensor side
+return type: unsigned char
+Description: Returns how much of the
+sensor given is over black, from 0
+over white to 16 over a whole line.
+================================ */
+unsigned char darkness(enum Sensor side)
+{
+    unsigned char contrast = black_level[side] - white_level[side];
+
+    if (readings[side] <= white_level[side])
+    {
+        return 0;
+    }
+
+    if (readings[side] >= black_level[side])
+    {
+        return 16;
+    }
+
+    return (unsigned int)(readings[side] - white_level[side]) * 16 / contrast;
+}
+
+/* ================================
+Function: line_position
+Paramaters: none
+return type: int
+Description: Returns the distance of
+the line right of the centre of the
+robot in mm, as the average of the
+sensor offsets weighted by how dark
+each sensor reads. Once the line has
+been lost the last position is kept
+so the robot steers back the way the
+line went. It is also kept while a
+marker or a crossing line is under
+the array, which would otherwise pull
+the robot towards it.
+================================ */
+int line_position(void)
+{
+    int moment = 0;
+    unsigned char total = 0;
+
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
+    {
+        unsigned char weight = darkness(i);
+
+        moment += weight * sensor_offset[i];
+        total += weight;
+    }
+
+    if (total < LINE_MIN_DARKNESS)
+    {
+        if (lost_ticks < 255)
+        {
+            lost_ticks++;
+        }
+    }
+    else
+    {
+        lost_ticks = 0;
+    }
+
+    if (total >= LINE_MIN_DARKNESS && total <= LINE_MAX_DARKNESS)
+    {
+        last_position = moment / total;
+    }
+
+    return last_position;
+}
+
+/* ================================
+Function: wait
+Paramaters: unsigned int time
+return type: none
+Description: Keeps the current
+motion going for the time given in
+ms while refreshing the sensor
+readings.
+================================ */
+void wait(unsigned int time)
 {
-    RIGHT_MOTOR_FORWARD = 0;
-    RIGHT_MOTOR_REVERSE = 0;
-    LEFT_MOTOR_FORWARD = 1;
-    LEFT_MOTOR_REVERSE = 0;
+    start_timer(MOTION_TIMER, time);
+
+    while (!timer_expired(MOTION_TIMER))
+    {
+        read_sensors();
+    }
 }
 
 /* ================================
-Function: swing_left
+Function: wait_tick
 Paramaters: none
 return type: none
-Description: Moves right motor
-forward.
+Description: Waits for the next 1ms
+control tick.
 ================================ */
-void swing_left(void)
+void wait_tick(void)
 {
-    RIGHT_MOTOR_FORWARD = 1;
-    RIGHT_MOTOR_REVERSE = 0;
-    LEFT_MOTOR_FORWARD = 0;
-    LEFT_MOTOR_REVERSE = 0;
+    while (!tick_pending)
+    {
+        NOP();
+    }
+
+    tick_pending = 0;
+
+#ifdef TRACE
+    // Ticks that come while this step runs belong to the next one. //
+    TMR2IE = 0;
+    trace_elapsed = trace_ticks;
+    trace_ticks = 0;
+    TMR2IE = 1;
+#endif
 }
 
 /* ================================
-Function: turn_right
+Function: sleep_idle
 Paramaters: none
-return type: none
-Description: Moves left motor
-forward and right motor backwards.
+return type: unsigned int
+Description: Puts the PIC to sleep
+between the ticks of IDLE until the
+start button changes or the watchdog
+wakes it. The clock stops, and with
+it Timer1, Timer2, the ADC and the
+EUSART, so it stays awake while
+telemetry is still going out. Returns
+the time in ms it slept for, WAKE_TIME
+if the watchdog woke it.
 ================================ */
-void turn_right(void)
+unsigned int sleep_idle(void)
 {
-    RIGHT_MOTOR_FORWARD = 0;
-    RIGHT_MOTOR_REVERSE = 1;
-    LEFT_MOTOR_FORWARD = 1;
-    LEFT_MOTOR_REVERSE = 0;
+    char button;
+
+#ifdef TELEMETRY
+    if (TXIE || !TRMT)
+    {
+        return 0;
+    }
+#endif
+
+    button = START_BUTTON; // Reading PORTA sets what interrupt-on-change compares the pin with.
+    RABIF = 0;
+    IOCA = 0b00100000; // Wake when the start button on RA5 changes.
+    RABIE = 1;
+    WDTCON = (WAKE_PRESCALER << 1) | 1; // Watchdog on, only while asleep.
+
+    SLEEP();
+    NOP(); // Executed as the PIC wakes, before the interrupt is taken.
+
+    WDTCON = WAKE_PRESCALER << 1;
+    RABIE = 0; // The conversion in progress was abandoned, the next tick starts it again.
+
+    return (START_BUTTON == button) ? WAKE_TIME : 0;
 }
 
 /* ================================
-Function: turn_left
-Paramaters: none
+Function: timer_expired
+Paramaters: enum Timer timer
+return type: char
+Description: Returns 1 if the timer
+given has counted down to 0.
+================================ */
+char timer_expired(enum Timer timer)
+{
+    char expired;
+
+    TMR2IE = 0; // The tick must not change the timer halfway through reading it.
+    expired = (timers[timer] == 0);
+    TMR2IE = 1;
+
+    return expired;
+}
+
+/* ================================
+Function: motion_time
+Paramaters: unsigned int time
+return type: unsigned int
+Description: Returns the time in ms
+a full speed motion tuned to take the
+time given on a fresh battery takes
+now. A drained battery cannot be
+driven any harder at full speed, so
+the motion is stretched instead.
+================================ */
+unsigned int motion_time(unsigned int time)
+{
+    if (supply_scale <= SUPPLY_ONE)
+    {
+        return time;
+    }
+
+    return ((unsigned long)time * supply_scale) / SUPPLY_ONE;
+}
+
+/* ================================
+Function: start_timer
+Paramaters: enum Timer timer, unsigned int time
 return type: none
-Description: Moves right motor
-forward and left motor backwards.
+Description: Loads the timer given
+with a time in ms to count down.
 ================================ */
-void turn_left(void)
+void start_timer(enum Timer timer, unsigned int time)
 {
-    RIGHT_MOTOR_FORWARD = 1;
-    RIGHT_MOTOR_REVERSE = 0;
-    LEFT_MOTOR_FORWARD = 0;
-    LEFT_MOTOR_REVERSE = 1;
+    TMR2IE = 0;
+    timers[timer] = time;
+    TMR2IE = 1;
 }
 
 /* ================================
-Function: stop
+Function: check_supply
 Paramaters: none
 return type: none
-Description: Stops both motors.
+Description: Averages every new
+reading of the 0.6V reference and
+works out the scale the wheel speeds
+are driven at. The reading rises as
+the supply drops, so the scale is the
+reading over NOMINAL_SUPPLY. The
+first reading is taken as it is.
 ================================ */
-void stop(void)
+void check_supply(void)
 {
-    RIGHT_MOTOR_FORWARD = 0;
-    RIGHT_MOTOR_REVERSE = 0;
-    LEFT_MOTOR_FORWARD = 0;
-    LEFT_MOTOR_REVERSE = 0;
+    unsigned int reading;
+    unsigned long scale;
+
+    if (supply_sequence == supply_checked)
+    {
+        return;
+    }
+
+    // The reading is 16 bit, so keep the interrupt from changing it half way through. //
+    ADIE = 0;
+    reading = supply_reading;
+    supply_checked = supply_sequence;
+    ADIE = 1;
+
+    if (supply_level == 0)
+    {
+        supply_level = reading << SUPPLY_SHIFT;
+    }
+    else
+    {
+        supply_level += reading - (supply_level >> SUPPLY_SHIFT);
+    }
+
+    scale = ((unsigned long)supply_level * SUPPLY_ONE / NOMINAL_SUPPLY) >> SUPPLY_SHIFT;
+    supply_scale = (scale > 0xFF) ? 0xFF : scale;
 }
 
 /* ================================
-Function: forward
+Function: filter_sample
+Paramaters: enum Sensor side, unsigned char reading
+return type: unsigned char
+Description: Returns the filtered
+value of the sensor given for the
+new sample given, in the mode picked
+by SENSOR_FILTER. Called by the ADC
+interrupt for every sample, so each
+mode only costs a few instructions.
+================================ */
+unsigned char filter_sample(enum Sensor side, unsigned char reading)
+{
+#if SENSOR_FILTER == FILTER_AVERAGE
+    filter_sum[side] += reading - filter_history[side][filter_index];
+    filter_history[side][filter_index] = reading;
+
+    return filter_sum[side] / FILTER_LENGTH;
+#elif SENSOR_FILTER == FILTER_MEDIAN
+    unsigned char newer = filter_history[side][0];
+    unsigned char older = filter_history[side][1];
+    unsigned char low = (newer < older) ? newer : older;
+    unsigned char high = (newer < older) ? older : newer;
+
+    filter_history[side][1] = newer;
+    filter_history[side][0] = reading;
+
+    // The median is the new sample clamped between the other two. //
+    if (reading < low)
+    {
+        return low;
+    }
+
+    return (reading > high) ? high : reading;
+#elif SENSOR_FILTER == FILTER_DEBOUNCE
+    char crossed = filter_black[side] ? reading < low_threshold[side] : reading > high_threshold[side];
+
+    if (!crossed)
+    {
+        filter_count[side] = 0;
+        filter_output[side] = reading;
+    }
+    else if (++filter_count[side] >= FILTER_LENGTH)
+    {
+        filter_count[side] = 0;
+        filter_black[side] = !filter_black[side];
+        filter_output[side] = reading;
+    }
+
+    return filter_output[side];
+#else
+    return reading;
+#endif
+}
+
+/* ================================
+Function: read_sensors
 Paramaters: none
 return type: none
-Description: Moves motors forward.
+Description: Copies the latest batch
+of readings of every sensor into
+readings. Retries if the ADC
+interrupt published a new batch
+during the copy so all values are
+always from the same batch. Then
+updates the colour of each sensor
+and, while calibrating, the lowest
+and highest readings seen.
 ================================ */
-void forward(void)
+void read_sensors(void)
 {
-    RIGHT_MOTOR_FORWARD = 1;
-    RIGHT_MOTOR_REVERSE = 0;
-    LEFT_MOTOR_FORWARD = 1;
-    LEFT_MOTOR_REVERSE = 0;
+    unsigned char sequence;
+
+    do
+    {
+        sequence = sample_sequence;
+
+        for (unsigned char i = 0; i < NUM_SENSORS; i++)
+        {
+            readings[i] = samples[sample_front][i];
+        }
+    } while (sequence != sample_sequence);
+
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
+    {
+        update_colour(i, readings[i]);
+
+        if (calibrating)
+        {
+            if (readings[i] < learned_white[i])
+            {
+                learned_white[i] = readings[i];
+            }
+
+            if (readings[i] > learned_black[i])
+            {
+                learned_black[i] = readings[i];
+            }
+        }
+    }
 }
 
 /* ================================
-Function: reverse
+Function: isr
 Paramaters: none
 return type: none
-Description: Reverses both motors.
+Description: Interrupt handler. The
+Timer2 tick counts down the software
+timers, drives the motor pins,
+starts the next batch of ADC
+conversions and
+releases the next mission step every
+1ms. Each wheel is switched on for
+the ticks where its duty accumulator
+overflows, which spreads the on time
+of the speed given evenly. The ADC
+converts every sensor channel back
+to back from the start of a tick, in
+enum Sensor order, writing into the
+back buffer and publishing it once
+every sensor has been read, with a
+conversion of the 0.6V reference
+after every SUPPLY_BATCHES batches. While
+capturing, comparator C1 stamps every
+crossing of the right sensor with the
+time from Timer1, and the edge is
+counted once the filtered reading has
+crossed the band the same way. With
+TELEMETRY, the TX interrupt moves the
+queued bytes into the EUSART one at a
+time. A change of the start button
+only has to wake the PIC from sleep.
 ================================ */
-void reverse(void)
+void interrupt isr(void)
 {
-    RIGHT_MOTOR_FORWARD = 0;
-    RIGHT_MOTOR_REVERSE = 1;
-    LEFT_MOTOR_FORWARD = 0;
-    LEFT_MOTOR_REVERSE = 1;
+    if (TMR1IF)
+    {
+        timer1_overflows++;
+        TMR1IF = 0;
+    }
+
+    // The start button only wakes sleep_idle(), which reads PORTA before it sleeps again. //
+    if (RABIE && RABIF)
+    {
+        RABIE = 0;
+        RABIF = 0;
+    }
+
+    if (TMR2IF)
+    {
+        for (unsigned char i = 0; i < NUM_TIMERS; i++)
+        {
+            if (timers[i] > 0)
+            {
+                timers[i]--;
+            }
+        }
+
+        right_duty += (right_drive < 0) ? -right_drive : right_drive;
+
+        if (right_duty >= MAX_SPEED)
+        {
+            right_duty -= MAX_SPEED;
+            RIGHT_MOTOR_FORWARD = (right_drive > 0);
+            RIGHT_MOTOR_REVERSE = (right_drive < 0);
+        }
+        else
+        {
+            RIGHT_MOTOR_FORWARD = 0;
+            RIGHT_MOTOR_REVERSE = 0;
+        }
+
+        left_duty += (left_drive < 0) ? -left_drive : left_drive;
+
+        if (left_duty >= MAX_SPEED)
+        {
+            left_duty -= MAX_SPEED;
+            LEFT_MOTOR_FORWARD = (left_drive > 0);
+            LEFT_MOTOR_REVERSE = (left_drive < 0);
+        }
+        else
+        {
+            LEFT_MOTOR_FORWARD = 0;
+            LEFT_MOTOR_REVERSE = 0;
+        }
+
+        tick_pending = 1;
+#ifdef TRACE
+        trace_ticks++;
+#endif
+        TMR2IF = 0;
+
+        // The ADC interrupt converts the rest of the batch. The channel was changed as the last batch ended, so it has had most of a tick to settle. //
+        GO_DONE = 1;
+    }
+
+    // Before the ADC, so an edge it counts has the latest crossing. //
+    if (C1IE && C1IF)
+    {
+        char over_line = C1OUT; // Reading the output ends the change, so the flag stays clear.
+
+        C1IF = 0;
+
+        if (over_line == !(edge_count & 1))
+        {
+            unsigned char high = TMR1H;
+            unsigned char overflows = timer1_overflows;
+
+            // Timer1 overflowed since the interrupt was entered, before TMR1H was read. //
+            if (TMR1IF && !(high & 0x80))
+            {
+                overflows++;
+            }
+
+            edge_time = ((unsigned int)overflows << 8) | high;
+        }
+    }
+
+    if (ADIF)
+    {
+        if (sample_side == NUM_SENSORS)
+        {
+            supply_reading = ((unsigned int)ADRESH << 2) | (ADRESL >> 6);
+            supply_sequence++;
+            sample_side = 0;
+        }
+        else
+        {
+            unsigned char back = sample_front ^ 1;
+            unsigned char reading = filter_sample(sample_side, ADRESH);
+
+            samples[back][sample_side] = reading;
+
+            // An even edge count means the last edge left a line, so look for the next one. //
+            if (sample_side == RIGHT_SENSOR && capturing && edge_count < 2 * NUM_BARS &&
+                ((edge_count & 1) ? reading < low_threshold[RIGHT_SENSOR] : reading > high_threshold[RIGHT_SENSOR]))
+            {
+                bar_edges[edge_count] = edge_time;
+                edge_count++;
+            }
+
+            if (++sample_side == NUM_SENSORS)
+            {
+                sample_front = back;
+                sample_sequence++;
+#if SENSOR_FILTER == FILTER_AVERAGE
+                filter_index = (filter_index + 1) & (FILTER_LENGTH - 1);
+#endif
+
+                // The reference is converted between every SUPPLY_BATCHES batches. //
+                if (sample_sequence & (SUPPLY_BATCHES - 1))
+                {
+                    sample_side = 0;
+                }
+            }
+        }
+
+        ADCON0bits.CHS = (sample_side == NUM_SENSORS) ? SUPPLY_CHANNEL : sensor_channel[sample_side];
+
+        ADIF = 0;
+
+        // The rest of the batch is converted back to back, about 56us a channel, so every reading in it is from the same spot. //
+        if (sample_side != 0)
+        {
+            _delay(ACQUISITION_CYCLES);
+            GO_DONE = 1;
+        }
+    }
+
+#ifdef TELEMETRY
+    if (TXIE && TXIF)
+    {
+        if (tx_tail != tx_head)
+        {
+            TXREG = tx_buffer[tx_tail];
+            tx_tail = (tx_tail + 1) & (TX_BUFFER_SIZE - 1);
+        }
+        else
+        {
+            TXIE = 0; // Nothing left to send, TXIF stays set while TXREG is empty.
+        }
+    }
+#endif
 }
 
 /* ================================
-Function: test
+Function: init_timer
 Paramaters: none
 return type: none
-Description: Test function for
-testing new code before implementing.
+Description: Starts Timer2 as the
+1ms control tick that every timed
+motion is measured with, and Timer1
+as the clock for barcode edges.
 ================================ */
-void test(void)
+void init_timer(void)
 {
-    // PUT TEST CODE HERE
+    for (unsigned char i = 0; i < NUM_TIMERS; i++)
+    {
+        timers[i] = 0;
+    }
+
+    PR2 = 124;          // 125 counts of 2us for every Timer2 period.
+    T2CON = 0b00011101; // Prescaler 1:4, postscaler 1:4 and Timer2 on for a 1ms tick.
+
+    T1CON = 0b00000001; // Timer1 on at Fosc/4 with no prescaler, so TMR1H counts 128us.
+
+    TMR1IF = 0;
+    TMR1IE = 1;
+    TMR2IF = 0;
+    TMR2IE = 1;
+    PEIE = 1;
+    GIE = 1;
 }
 
 /* ================================
-Function: reset_barcode_width
+Function: load_levels
 Paramaters: none
 return type: none
-Description: Initialization function
-that clears the array that stores
-the width of the barcode lines.
+Description: Loads the sensor levels
+saved by the last calibration from
+EEPROM, keeping the defaults if none
+have been saved yet.
 ================================ */
-void reset_barcode_width(void)
+void load_levels(void)
 {
-    for (int i = 0; i < 5; i++)
+    if (eeprom_read(EEPROM_LEVELS_KEY) == LEVELS_KEY)
     {
-        barcode_width[i] = 0;
+        for (unsigned char i = 0; i < NUM_SENSORS; i++)
+        {
+            white_level[i] = eeprom_read(EEPROM_LEVELS + 2 * i);
+            black_level[i] = eeprom_read(EEPROM_LEVELS + 2 * i + 1);
+        }
     }
+
+    set_thresholds();
 }
 
 /* ================================
-Function: black
-Paramaters: int reading
-return type: char
-Description: Returns 1 if sensor
-reads black.
+Function: save_levels
+Paramaters: none
+return type: none
+Description: Saves the sensor levels
+to EEPROM. Only bytes that changed
+are written to spare the EEPROM.
 ================================ */
-char black(int reading)
+void save_levels(void)
 {
-    if (reading > SENSOR_THRESHOLD)
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
     {
-        return 1;
+        if (eeprom_read(EEPROM_LEVELS + 2 * i) != white_level[i])
+        {
+            eeprom_write(EEPROM_LEVELS + 2 * i, white_level[i]);
+        }
+
+        if (eeprom_read(EEPROM_LEVELS + 2 * i + 1) != black_level[i])
+        {
+            eeprom_write(EEPROM_LEVELS + 2 * i + 1, black_level[i]);
+        }
     }
-    else
+
+    if (eeprom_read(EEPROM_LEVELS_KEY) != LEVELS_KEY)
     {
-        return 0;
+        eeprom_write(EEPROM_LEVELS_KEY, LEVELS_KEY);
     }
-}
 
+    levels_changed = 0;
+}
 
 /* ================================
-Function: white
-Paramaters: int reading
-return type: char
-Description: Returns 1 if sensor
-reads white.
+Function: load_profile
+Paramaters: none
+return type: none
+Description: Loads the segment
+lengths learned on earlier runs from
+EEPROM. Erased EEPROM reads as
+PROFILE_UNKNOWN, so the perimeter is
+followed at CRUISE_SPEED until a
+segment has been learned.
 ================================ */
-char white(int reading)
+void load_profile(void)
 {
-    if (reading < SENSOR_THRESHOLD)
+    for (unsigned char i = 0; i < NUM_SECTIONS; i++)
     {
-        return 1;
+        segment_length[i] = eeprom_read(EEPROM_PROFILE + 2 * i) | ((unsigned int)eeprom_read(EEPROM_PROFILE + 2 * i + 1) << 8);
     }
-    else
+}
+
+/* ================================
+Function: save_profile
+Paramaters: none
+return type: none
+Description: Saves the segment
+lengths to EEPROM. Only bytes that
+changed are written to spare the
+EEPROM.
+================================ */
+void save_profile(void)
+{
+    for (unsigned char i = 0; i < 2 * NUM_SECTIONS; i++)
     {
-        return 0;
+        unsigned char value = (i & 1) ? segment_length[i / 2] >> 8 : segment_length[i / 2] & 0xFF;
+
+        if (eeprom_read(EEPROM_PROFILE + i) != value)
+        {
+            eeprom_write(EEPROM_PROFILE + i, value);
+        }
     }
+
+    profile_changed = 0;
 }
 
 /* ================================
-Function: get_sensor
-Paramaters: enum Sensor side
-return type: int
-Description: Reads sensor of the
-side given and returns its value.
+Function: set_thresholds
+Paramaters: none
+return type: none
+Description: Works out the hysteresis
+band of each sensor from its levels.
 ================================ */
-int get_sensor(enum Sensor side)
+void set_thresholds(void)
 {
-    if (side == RIGHT_SENSOR)
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
     {
-        ADCON0bits.CHS = RIGHT_SENSOR_CHANNEL;
+        unsigned char contrast = black_level[i] - white_level[i];
+        unsigned char middle = white_level[i] + contrast / 2;
+        unsigned char band = (unsigned int)contrast * HYSTERESIS / 16;
+
+        low_threshold[i] = middle - band;
+        high_threshold[i] = middle + band;
     }
-    else if (side == LEFT_SENSOR)
+}
+
+/* ================================
+Function: init_sensors
+Paramaters: none
+return type: none
+Description: Sets up the ADC for the
+interrupt driven sampling of every
+light sensor and the supply. The
+first conversion is started by the
+next tick.
+================================ */
+void init_sensors(void)
+{
+    TRISA = 0b00110110; // Set pins AN1, AN2 and AN3 on the A register to inputs for the sensors.
+
+    ANSEL = 0b00001110;  // Set pins AN1, AN2 and AN3 to analogue inputs.
+    ADCON1 = 0b00100000; // ADC clock of Fosc/32 for a 4us conversion period at 8MHz.
+    ADCON0 = 0b00000001; // Turn on the ADC.
+    VRCON = REFERENCE_ON; // Turn on the 0.6V reference the supply is measured against, and CVREF.
+    CM1CON0 = COMPARATOR_SETUP;
+
+    sample_side = NUM_SENSORS; // The supply is measured first, before the robot moves.
+    ADCON0bits.CHS = SUPPLY_CHANNEL;
+
+    ADIF = 0;
+    ADIE = 1; // Interrupt at the end of every conversion.
+    PEIE = 1;
+    GIE = 1;
+}
+
+/* ================================
+Function: reference_setting
+Paramaters: unsigned char level
+return type: unsigned char
+Description: Returns the VRCON that
+puts CVREF nearest the 8 bit reading
+given. The high range has the finer
+steps, so it is used where it can
+reach.
+================================ */
+unsigned char reference_setting(unsigned char level)
+{
+    unsigned char step;
+
+    if (level >= 64)
     {
-        ADCON0bits.CHS = LEFT_SENSOR_CHANNEL;
+        step = (level - 60) >> 3; // (level - 64) / 8, rounded.
+
+        return REFERENCE_ON | ((step > 15) ? 15 : step);
     }
 
-    GO_DONE = 1;
-    while(GO_DONE);
-    return ADRESH;
+    step = (level * 3 + 16) >> 5; // level * 24 / 256, rounded.
+
+    return REFERENCE_ON | REFERENCE_LOW_RANGE | step;
 }
 
+/* ================================
+Function: start_capture
+Paramaters: none
+return type: none
+Description: Starts timestamping the
+barcode edges under the right sensor
+with comparator C1. CVREF is put in
+the middle of the band, which the
+sensor crosses before the filtered
+reading leaves the band, either way.
+================================ */
+void start_capture(void)
+{
+    C1IE = 0;
+    VRCON = reference_setting((low_threshold[RIGHT_SENSOR] + high_threshold[RIGHT_SENSOR]) / 2);
+    edge_count = 0;
+    capturing = 1;
+
+    (void)C1OUT; // Reading the output at the new reference ends any change it made.
+    C1IF = 0;
+    C1IE = 1;
+}
+
+/* ================================
+Function: stop_capture
+Paramaters: none
+return type: none
+Description: Stops timestamping
+barcode edges.
+================================ */
+void stop_capture(void)
+{
+    C1IE = 0;
+    capturing = 0;
+}
 
 /* ================================
 Function: init_hardware
@@ -873,34 +2671,57 @@ void init_hardware(void)
 	ANSEL = 0b00000000;
 	ANSELH = 0b00000000;
 
-	PORTC = 0b00000000;
-
-    _delay(100000);
+	set_leds(0b00000000);
+}
 
-    char led = 0b00000001;
+/* ================================
+Function: self_test
+Paramaters: none
+return type: unsigned char
+Description: Checks the robot over
+at power up in place of a light show.
+Pulses each wheel both ways, so a
+dead motor or driver can be seen and
+the robot ends where it started, while
+the ADC fills in its first readings.
+Returns ADC_FAULT if the sensors or
+the supply were not converted, and
+bit i for each sensor that did not
+read the colour it sits on at the
+start spot against the stored levels,
+or that reads far below its white
+level as a dead channel does.
+================================ */
+unsigned char self_test(void)
+{
+    unsigned char faults = 0;
+    unsigned char sequence = sample_sequence;
+    unsigned char supplies = supply_sequence;
+
+    set_motors(MAX_SPEED, 0);
+    wait(MOTOR_PULSE_TIME);
+    set_motors(-MAX_SPEED, 0);
+    wait(MOTOR_PULSE_TIME);
+    set_motors(0, MAX_SPEED);
+    wait(MOTOR_PULSE_TIME);
+    set_motors(0, -MAX_SPEED);
+    wait(MOTOR_PULSE_TIME);
+    stop();
+    wait(MOTOR_PULSE_TIME); // The robot comes to rest, and the motor lines are cleared before the PIC can sleep.
 
-    for (int i = 0; i < 8; i++)
+    if (sample_sequence == sequence || supply_sequence == supplies)
     {
-        PORTC = PORTC | led;
-        led = led << 1;
-        _delay(100000);
+        return ADC_FAULT;
     }
 
-    _delay(150000);
-
-    for (int i = 0; i < 8; i++)
+    for (unsigned char i = 0; i < NUM_SENSORS; i++)
     {
-        PORTC = PORTC << 1;
-        _delay(100000);
+        // A dead channel reads about 0, which would pass for white on the outer sensors. //
+        if ((i == CENTRE_SENSOR) ? readings[i] <= high_threshold[i] : (readings[i] >= low_threshold[i] || readings[i] < white_level[i] >> WHITE_FLOOR_SHIFT))
+        {
+            faults |= 1 << i;
+        }
     }
 
-	for (int i =0; i < 2; i++)
-	{
-		PORTC = 0b11111111;
-		_delay(125000);
-		PORTC = 0b00000000;
-		_delay(125000);
-	}
-
-	_delay(750000);
+    return faults;
 }
@@ -0,0 +1,159 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: decode_telemetry.c
+Description: Turns the telemetry
+stream robot.c sends over the EUSART
+into CSV, one row per record. Reads
+a capture file, or standard input so
+a serial port can be piped straight
+in. Damaged records are skipped and
+dropped ones reported.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// RECORD FORMAT, AS SENT BY send_telemetry() IN robot.c //
+#define TELEMETRY_PERIOD  10   // Time in ms between records.
+#define TELEMETRY_SYNC    0xA5 // First byte of every record.
+#define TELEMETRY_RECORD  10   // Bytes in a record.
+#define NUM_SENSORS       3
+
+static const char *phase_names [] = {"waiting", "starting", "entering", "adjusting", "scanning", "delivering", "returning"};
+
+// Returns 1 if the record has the sync byte and a matching sum. //
+static int valid(const unsigned char *record)
+{
+    unsigned char sum = 0;
+
+    if (record[0] != TELEMETRY_SYNC)
+    {
+        return 0;
+    }
+
+    for (int i = 1; i < TELEMETRY_RECORD - 1; i++)
+    {
+        sum += record[i];
+    }
+
+    return sum == record[TELEMETRY_RECORD - 1];
+}
+
+static void print_record(const unsigned char *record, unsigned long number)
+{
+    unsigned char phase = record[2];
+
+    printf("%lu,%lu,", number, number * TELEMETRY_PERIOD);
+
+    if (phase < sizeof(phase_names) / sizeof(phase_names[0]))
+    {
+        printf("%s", phase_names[phase]);
+    }
+    else
+    {
+        printf("%d", phase);
+    }
+
+    printf(",%d", (signed char)record[3]);
+
+    for (int i = 0; i < NUM_SENSORS; i++)
+    {
+        printf(",%d", record[4 + i]);
+    }
+
+    printf(",%d,%d\n", (signed char)record[4 + NUM_SENSORS], (signed char)record[5 + NUM_SENSORS]);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    unsigned char record [TELEMETRY_RECORD];
+    int length = 0;
+    int c;
+    int started = 0;
+    unsigned char last_sequence = 0;
+    unsigned long number = 0;
+    unsigned long dropped = 0;
+    unsigned long skipped = 0;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [telemetry.bin]\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 2 && !(input = fopen(argv[1], "rb")))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("record,time_ms,phase,marker_count,right_sensor,centre_sensor,left_sensor,right_speed,left_speed\n");
+
+    while ((c = getc(input)) != EOF)
+    {
+        record[length++] = c;
+
+        if (length < TELEMETRY_RECORD)
+        {
+            // Wait for a sync byte before collecting a record. //
+            if (length == 1 && c != TELEMETRY_SYNC)
+            {
+                length = 0;
+                skipped++;
+            }
+
+            continue;
+        }
+
+        if (!valid(record))
+        {
+            // Look for the next sync byte inside the bytes already read. //
+            int next = 1;
+
+            while (next < TELEMETRY_RECORD && record[next] != TELEMETRY_SYNC)
+            {
+                next++;
+            }
+
+            skipped += next;
+            length -= next;
+
+            for (int i = 0; i < length; i++)
+            {
+                record[i] = record[next + i];
+            }
+
+            continue;
+        }
+
+        // Record numbers are 8 bit, so a gap shows how many records the robot dropped. //
+        if (started)
+        {
+            unsigned char gap = record[1] - last_sequence;
+
+            dropped += gap - 1;
+            number += gap;
+        }
+        else
+        {
+            number = record[1];
+            started = 1;
+        }
+
+        last_sequence = record[1];
+        print_record(record, number);
+        length = 0;
+    }
+
+    if (dropped || skipped)
+    {
+        fprintf(stderr, "%lu records dropped by the robot, %lu bytes skipped\n", dropped, skipped);
+    }
+
+    if (input != stdin)
+    {
+        fclose(input);
+    }
+
+    return 0;
+}
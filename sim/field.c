@@ -0,0 +1,245 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: field.c
+Description: Model of the playing
+field. Every black line is an axis
+aligned rectangle in mm, with the
+origin at the centre of the bottom
+left corner of the perimeter line
+and y pointing to the top edge.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include "sim.h"
+
+// FIELD DIMENSIONS //
+#define FIELD_WIDTH       1600.0 // Distance between the centres of the left and right perimeter lines.
+#define FIELD_HEIGHT      600.0  // Distance between the centres of the bottom and top perimeter lines.
+#define LINE_WIDTH        19.0   // Width of the electrical tape the field is made of.
+
+// Home is reached from the bottom perimeter line and every other section from the top one, across the field from it. //
+// Clockwise from home they are destinations 1 and 3, the barcode, then destinations 2 and 0. //
+#define HOME_X            600.0
+#define DEST1_X           300.0
+#define DEST3_X           550.0
+#define BARCODE_X         800.0
+#define DEST2_X           1050.0
+#define DEST0_X           1300.0
+
+#define MARKER_LENGTH     150.0  // Length of the parking spot lines outside the perimeter.
+#define STUB_LENGTH       60.0   // Length of a section entrance line outside the perimeter.
+#define HOME_DEPTH        300.0  // Length of the home line inside the perimeter.
+#define HOME_GATE         220.0  // Distance of the home gate line inside the perimeter.
+#define BARCODE_DEPTH     170.0  // Length of the barcode approach line inside the perimeter.
+#define BAR_START         200.0  // Distance of the first bar inside the perimeter.
+#define BAR_LENGTH        120.0  // Length of each bar.
+#define BAR_SPACING       40.0   // Distance between the leading edges of two bars.
+#define NARROW_BAR        10.0
+#define WIDE_BAR          30.0
+#define NUM_BARS          5
+
+#define MAX_LINES         32
+
+struct Line
+{
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+};
+
+static struct Line lines [MAX_LINES];
+static int num_lines = 0;
+
+static void add_line(double x0, double y0, double x1, double y1)
+{
+    if (num_lines < MAX_LINES)
+    {
+        lines[num_lines].x0 = (x0 < x1) ? x0 : x1;
+        lines[num_lines].y0 = (y0 < y1) ? y0 : y1;
+        lines[num_lines].x1 = (x0 < x1) ? x1 : x0;
+        lines[num_lines].y1 = (y0 < y1) ? y1 : y0;
+        num_lines++;
+    }
+}
+
+// Length of the overlap of two intervals. //
+static double overlap(double a0, double a1, double b0, double b1)
+{
+    double low = (a0 > b0) ? a0 : b0;
+    double high = (a1 < b1) ? a1 : b1;
+
+    return (high > low) ? high - low : 0.0;
+}
+
+// Adds a line of tape between two centre points. //
+static void add_tape(double x0, double y0, double x1, double y1)
+{
+    double half = LINE_WIDTH / 2;
+
+    if (x0 == x1)
+    {
+        add_line(x0 - half, y0, x0 + half, y1);
+    }
+    else
+    {
+        add_line(x0, y0 - half, x1, y0 + half);
+    }
+}
+
+/* ================================
+Function: field_build
+Paramaters: int stops
+return type: none
+Description: Lays out the field with
+the barcode encoding the mask of
+destinations given, one wide bar for
+each of them.
+================================ */
+void field_build(int stops)
+{
+    double half = LINE_WIDTH / 2;
+    double bar = FIELD_HEIGHT - BAR_START;
+
+    num_lines = 0;
+
+    // PERIMETER //
+    add_tape(-half, FIELD_HEIGHT, FIELD_WIDTH + half, FIELD_HEIGHT);
+    add_tape(-half, 0, FIELD_WIDTH + half, 0);
+    add_tape(0, -half, 0, FIELD_HEIGHT + half);
+    add_tape(FIELD_WIDTH, -half, FIELD_WIDTH, FIELD_HEIGHT + half);
+
+    // PARKING SPOTS //
+    add_tape(DEST0_X, FIELD_HEIGHT, DEST0_X, FIELD_HEIGHT + MARKER_LENGTH);
+    add_tape(DEST1_X, FIELD_HEIGHT, DEST1_X, FIELD_HEIGHT + MARKER_LENGTH);
+    add_tape(DEST2_X, FIELD_HEIGHT, DEST2_X, FIELD_HEIGHT + MARKER_LENGTH);
+    add_tape(DEST3_X, FIELD_HEIGHT, DEST3_X, FIELD_HEIGHT + MARKER_LENGTH);
+
+    // HOME SECTION //
+    add_tape(HOME_X, -STUB_LENGTH, HOME_X, HOME_DEPTH);
+    add_tape(HOME_X - 100, HOME_GATE, HOME_X + 100, HOME_GATE);
+
+    // BARCODE SECTION //
+    add_tape(BARCODE_X, FIELD_HEIGHT - BARCODE_DEPTH, BARCODE_X, FIELD_HEIGHT + STUB_LENGTH);
+
+    for (int i = 0; i < NUM_BARS; i++)
+    {
+        double width = (i > 0 && (stops & (1 << (i - 1)))) ? WIDE_BAR : NARROW_BAR;
+
+        add_line(BARCODE_X - BAR_LENGTH / 2, bar - width, BARCODE_X + BAR_LENGTH / 2, bar);
+        bar -= BAR_SPACING;
+    }
+}
+
+/* ================================
+Function: field_reflectance
+Paramaters: double x, double y, double size
+return type: double
+Description: Returns the fraction of
+the square of the size given centred
+on the point given that is covered by
+black lines, from 0 for white board
+to 1 for a solid line.
+================================ */
+double field_reflectance(double x, double y, double size)
+{
+    double half = size / 2;
+    double black = 0;
+
+    for (int i = 0; i < num_lines; i++)
+    {
+        double width = overlap(x - half, x + half, lines[i].x0, lines[i].x1);
+        double height = overlap(y - half, y + half, lines[i].y0, lines[i].y1);
+
+        black += width * height;
+    }
+
+    black /= size * size;
+
+    return (black > 1.0) ? 1.0 : black;
+}
+
+/* ================================
+Function: field_zone
+Paramaters: double x, double y
+return type: int
+Description: Returns the section the
+point given is in as an enum SimZone.
+================================ */
+int field_zone(double x, double y)
+{
+    const double dest_x [4] = {DEST0_X, DEST1_X, DEST2_X, DEST3_X};
+
+    if (y > FIELD_HEIGHT)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (x > dest_x[i] - 80 && x < dest_x[i] + 80 && y < FIELD_HEIGHT + MARKER_LENGTH + 100)
+            {
+                return ZONE_DEST0 + i;
+            }
+        }
+
+        return ZONE_NONE;
+    }
+
+    if (x > HOME_X - 120 && x < HOME_X + 120 && y < HOME_DEPTH + 100)
+    {
+        return ZONE_HOME;
+    }
+
+    if (x > BARCODE_X - 150 && x < BARCODE_X + 150 && y > FIELD_HEIGHT - BAR_START - NUM_BARS * BAR_SPACING - 150)
+    {
+        return ZONE_BARCODE;
+    }
+
+    return ZONE_NONE;
+}
+
+/* ================================
+Function: field_start_pose
+Paramaters: double *x, double *y, double *heading
+return type: none
+Description: Gives the nominal start
+position in mm and heading in degrees
+anticlockwise from the x axis, facing
+out of the home section.
+================================ */
+void field_start_pose(double *x, double *y, double *heading)
+{
+    *x = HOME_X;
+    *y = HOME_GATE + 110;
+    *heading = -90.0;
+}
+
+/* ================================
+Function: field_zone_name
+Paramaters: int zone
+return type: const char *
+Description: Returns a printable name
+for the zone given.
+================================ */
+const char *field_zone_name(int zone)
+{
+    switch (zone)
+    {
+        case ZONE_HOME:
+            return "home";
+
+        case ZONE_BARCODE:
+            return "barcode";
+
+        case ZONE_DEST0:
+            return "destination 0";
+
+        case ZONE_DEST1:
+            return "destination 1";
+
+        case ZONE_DEST2:
+            return "destination 2";
+
+        case ZONE_DEST3:
+            return "destination 3";
+
+        default:
+            return "field";
+    }
+}
@@ -0,0 +1,108 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: pic.h
+Description: Host stand-in for the
+XC8 device header used to build
+robot.c against the simulator. Every
+special function register access
+costs one instruction cycle of
+simulated time, which is also when
+peripherals and interrupts are run.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#ifndef SIM_PIC_H
+#define SIM_PIC_H
+
+// COMPILER EXTENSIONS //
+#define __CONFIG(x)
+#define interrupt
+
+#include "registers.h"
+
+// Every access goes through sim_cycle() first so the peripherals see the program running. //
+#define SIM_SFR(name)   (*(sim_cycle(1), &sim_regs.name))
+
+// SPECIAL FUNCTION REGISTERS //
+#define OSCCON          SIM_SFR(osccon).byte
+#define OSCCONbits      SIM_SFR(osccon).bits
+#define PORTA           SIM_SFR(porta).byte
+#define PORTB           SIM_SFR(portb).byte
+#define PORTC           SIM_SFR(portc).byte
+#define TRISA           SIM_SFR(trisa)
+#define TRISB           SIM_SFR(trisb)
+#define TRISC           SIM_SFR(trisc)
+#define ANSEL           SIM_SFR(ansel)
+#define ANSELH          SIM_SFR(anselh)
+#define INTCON          SIM_SFR(intcon).byte
+#define PIR1            SIM_SFR(pir1).byte
+#define PIE1            SIM_SFR(pie1).byte
+#define PIR2            SIM_SFR(pir2).byte
+#define PIE2            SIM_SFR(pie2).byte
+#define ADCON0          SIM_SFR(adcon0).byte
+#define ADCON0bits      SIM_SFR(adcon0).bits
+#define ADCON1          SIM_SFR(adcon1)
+#define ADRESH          SIM_SFR(adresh)
+#define ADRESL          SIM_SFR(adresl)
+#define T1CON           SIM_SFR(t1con).byte
+#define T1CONbits       SIM_SFR(t1con).bits
+#define TMR1L           SIM_SFR(tmr1l)
+#define TMR1H           SIM_SFR(tmr1h)
+#define T2CON           SIM_SFR(t2con).byte
+#define T2CONbits       SIM_SFR(t2con).bits
+#define PR2             SIM_SFR(pr2)
+#define TMR2            SIM_SFR(tmr2)
+#define TXSTA           SIM_SFR(txsta)
+#define RCSTA           SIM_SFR(rcsta)
+#define BAUDCTL         SIM_SFR(baudctl)
+#define SPBRG           SIM_SFR(spbrg)
+#define SPBRGH          SIM_SFR(spbrgh)
+#define TXREG           SIM_SFR(txreg)
+#define IOCA            SIM_SFR(ioca)
+#define VRCON           SIM_SFR(vrcon)
+#define CM1CON0         SIM_SFR(cm1con0).byte
+#define CM1CON0bits     SIM_SFR(cm1con0).bits
+#define WDTCON          SIM_SFR(wdtcon)
+
+// REGISTER BITS //
+#define RA0             SIM_SFR(porta).bits.RA0
+#define RA1             SIM_SFR(porta).bits.RA1
+#define RA2             SIM_SFR(porta).bits.RA2
+#define RA3             SIM_SFR(porta).bits.RA3
+#define RA4             SIM_SFR(porta).bits.RA4
+#define RA5             SIM_SFR(porta).bits.RA5
+#define RB4             SIM_SFR(portb).bits.RB4
+#define RB5             SIM_SFR(portb).bits.RB5
+#define RB6             SIM_SFR(portb).bits.RB6
+#define RB7             SIM_SFR(portb).bits.RB7
+#define RC6             SIM_SFR(portc).bits.RC6
+#define RC7             SIM_SFR(portc).bits.RC7
+#define GIE             SIM_SFR(intcon).bits.GIE
+#define RABIE           SIM_SFR(intcon).bits.RABIE
+#define RABIF           SIM_SFR(intcon).bits.RABIF
+#define PEIE            SIM_SFR(intcon).bits.PEIE
+#define ADIF            SIM_SFR(pir1).bits.ADIF
+#define ADIE            SIM_SFR(pie1).bits.ADIE
+#define TMR1IF          SIM_SFR(pir1).bits.TMR1IF
+#define TMR1IE          SIM_SFR(pie1).bits.TMR1IE
+#define TMR1ON          SIM_SFR(t1con).bits.TMR1ON
+#define TMR2IF          SIM_SFR(pir1).bits.TMR2IF
+#define TMR2IE          SIM_SFR(pie1).bits.TMR2IE
+#define TMR2ON          SIM_SFR(t2con).bits.TMR2ON
+#define C1IF            SIM_SFR(pir2).bits.C1IF
+#define C1IE            SIM_SFR(pie2).bits.C1IE
+#define C1OUT           SIM_SFR(cm1con0).bits.C1OUT
+#define TXIF            SIM_SFR(pir1).bits.TXIF
+#define TXIE            SIM_SFR(pie1).bits.TXIE
+#define TRMT            ((SIM_SFR(txsta) >> 1) & 1)
+#define GO_DONE         SIM_SFR(adcon0).bits.GO
+#define GO_nDONE        SIM_SFR(adcon0).bits.GO
+
+// INTRINSICS //
+#define NOP()           sim_nop()
+#define SLEEP()         sim_sleep()
+#define _delay(n)       sim_delay(n)
+
+// EEPROM LIBRARY //
+#define eeprom_read(a)     sim_eeprom_read(a)
+#define eeprom_write(a, v) sim_eeprom_write(a, v)
+
+#endif
@@ -0,0 +1,524 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: profile.c
+Description: Profiles robot.c in the
+simulator when it is built with
+-finstrument-functions. Every call
+is followed on a stack of its own, so
+simulated time, ADC conversions, NOP
+spins, _delay() time and sleep can be
+charged to the function running at
+the time. Writes a flat report per
+function and per call site, and the
+call tree, after the mission.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+#define MAX_NODES   4096   // Distinct paths through the call tree.
+#define MAX_SITES   4096   // Distinct call sites, a power of 2 for the hash.
+#define MAX_DEPTH   64     // Deepest call followed, deeper ones are charged to the caller.
+#define NAME_LENGTH 64
+
+// What the program did while one function, call site or path was running. //
+struct Costs
+{
+    double time;               // Simulated time in s.
+    unsigned long conversions; // ADC conversions started.
+    unsigned long spins;       // NOP() busy wait iterations.
+    double delay;              // Time in s spent in _delay().
+    double sleep;              // Time in s the PIC slept.
+};
+
+// One path through the call tree, with what it did itself, outside its callees. //
+struct Node
+{
+    void *function;
+    int child;                 // First callee, -1 if none.
+    int sibling;               // Next callee of the parent, -1 if none.
+    unsigned long calls;
+    struct Costs self;
+};
+
+// One call site, with everything done until the callee returned. //
+struct Site
+{
+    void *function;
+    void *call_site;
+    unsigned long calls;
+    struct Costs total;
+};
+
+struct Frame
+{
+    int node;
+    int site;                  // -1 if the site table is full.
+    struct Costs start;        // Running totals when the call was made.
+};
+
+static struct Node nodes [MAX_NODES];
+static int node_count;
+static int roots = -1;         // First function called from outside robot.c, -1 if none.
+static struct Site sites [MAX_SITES];
+static int site_count;
+static struct Frame stack [MAX_DEPTH];
+static int depth;
+static int skipped;            // Calls too deep for the stack, still to return.
+static struct Costs running;   // Totals of the whole run so far.
+static double last_time;       // Simulated time the costs were last charged.
+
+// FUNCTIONS GCC CALLS, WHICH MUST NOT BE INSTRUMENTED THEMSELVES //
+void __cyg_profile_func_enter(void *function, void *call_site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void *function, void *call_site) __attribute__((no_instrument_function));
+
+// Charges the simulated time since the last call or return to the function running. //
+static void charge_time(void)
+{
+    double now = sim_time();
+
+    if (depth > 0)
+    {
+        nodes[stack[depth - 1].node].self.time += now - last_time;
+        running.time += now - last_time;
+    }
+
+    last_time = now;
+}
+
+static struct Costs *current(void)
+{
+    return (depth > 0) ? &nodes[stack[depth - 1].node].self : NULL;
+}
+
+// Returns the callee of the node given running the function given, adding it if it is new. //
+static int find_child(int parent, void *function)
+{
+    int *link = (parent >= 0) ? &nodes[parent].child : &roots;
+    int node;
+
+    for (node = *link; node >= 0; node = nodes[node].sibling)
+    {
+        if (nodes[node].function == function)
+        {
+            return node;
+        }
+    }
+
+    if (node_count == MAX_NODES)
+    {
+        return -1;
+    }
+
+    node = node_count++;
+    nodes[node].function = function;
+    nodes[node].child = -1;
+    nodes[node].sibling = *link;
+    *link = node;
+
+    return node;
+}
+
+// Returns the entry of the call site given in the open addressed site table, adding it if it is new. //
+static int find_site(void *function, void *call_site)
+{
+    unsigned long hash = ((unsigned long)call_site >> 2) * 2654435761UL;
+
+    for (int i = 0; i < MAX_SITES; i++)
+    {
+        int site = (hash + i) & (MAX_SITES - 1);
+
+        if (sites[site].call_site == call_site && sites[site].function == function)
+        {
+            return site;
+        }
+
+        if (!sites[site].call_site)
+        {
+            if (site_count == MAX_SITES - 1)
+            {
+                return -1;
+            }
+
+            site_count++;
+            sites[site].function = function;
+            sites[site].call_site = call_site;
+            return site;
+        }
+    }
+
+    return -1;
+}
+
+// Adds what was done since the frame given was entered to its call site. //
+static void close_frame(const struct Frame *frame)
+{
+    struct Site *site;
+
+    if (frame->site < 0)
+    {
+        return;
+    }
+
+    site = &sites[frame->site];
+    site->total.time += running.time - frame->start.time;
+    site->total.conversions += running.conversions - frame->start.conversions;
+    site->total.spins += running.spins - frame->start.spins;
+    site->total.delay += running.delay - frame->start.delay;
+    site->total.sleep += running.sleep - frame->start.sleep;
+}
+
+void __cyg_profile_func_enter(void *function, void *call_site)
+{
+    int node;
+
+    charge_time();
+
+    if (depth == MAX_DEPTH)
+    {
+        skipped++;
+        return;
+    }
+
+    node = find_child((depth > 0) ? stack[depth - 1].node : -1, function);
+
+    if (node < 0)
+    {
+        skipped++;
+        return;
+    }
+
+    nodes[node].calls++;
+    stack[depth].node = node;
+    stack[depth].site = find_site(function, call_site);
+    stack[depth].start = running;
+
+    if (stack[depth].site >= 0)
+    {
+        sites[stack[depth].site].calls++;
+    }
+
+    depth++;
+}
+
+void __cyg_profile_func_exit(void *function, void *call_site)
+{
+    (void)function;
+    (void)call_site;
+
+    charge_time();
+
+    if (skipped > 0)
+    {
+        skipped--;
+        return;
+    }
+
+    if (depth > 0)
+    {
+        depth--;
+        close_frame(&stack[depth]);
+    }
+}
+
+/* ================================
+Function: profile_conversion
+Paramaters: none
+return type: none
+Description: Charges an ADC
+conversion to the function that
+started it.
+================================ */
+void profile_conversion(void)
+{
+    struct Costs *costs = current();
+
+    if (costs)
+    {
+        costs->conversions++;
+        running.conversions++;
+    }
+}
+
+/* ================================
+Function: profile_spin
+Paramaters: none
+return type: none
+Description: Charges a NOP() busy
+wait iteration to the function
+running.
+================================ */
+void profile_spin(void)
+{
+    struct Costs *costs = current();
+
+    if (costs)
+    {
+        costs->spins++;
+        running.spins++;
+    }
+}
+
+/* ================================
+Function: profile_delay
+Paramaters: double time
+return type: none
+Description: Charges the time in s
+of a _delay() to the function that
+called it.
+================================ */
+void profile_delay(double time)
+{
+    struct Costs *costs = current();
+
+    if (costs)
+    {
+        costs->delay += time;
+        running.delay += time;
+    }
+}
+
+/* ================================
+Function: profile_sleep
+Paramaters: double time
+return type: none
+Description: Charges the time in s
+the PIC slept to the function that
+put it to sleep.
+================================ */
+void profile_sleep(double time)
+{
+    struct Costs *costs = current();
+
+    if (costs)
+    {
+        costs->sleep += time;
+        running.sleep += time;
+    }
+}
+
+// Name of the function at the address given, with the offset into it if it does not start there. //
+static const char *symbol(void *address, char *name)
+{
+    Dl_info info;
+
+    if (dladdr(address, &info) && info.dli_sname)
+    {
+        unsigned long offset = (char *)address - (char *)info.dli_saddr;
+
+        if (offset)
+        {
+            snprintf(name, NAME_LENGTH, "%s+0x%lx", info.dli_sname, offset);
+        }
+        else
+        {
+            snprintf(name, NAME_LENGTH, "%s", info.dli_sname);
+        }
+    }
+    else
+    {
+        snprintf(name, NAME_LENGTH, "%p", address);
+    }
+
+    return name;
+}
+
+static void add_costs(struct Costs *to, const struct Costs *from)
+{
+    to->time += from->time;
+    to->conversions += from->conversions;
+    to->spins += from->spins;
+    to->delay += from->delay;
+    to->sleep += from->sleep;
+}
+
+// Costs of the node given and everything it called. //
+static struct Costs node_total(int node)
+{
+    struct Costs total = nodes[node].self;
+
+    for (int child = nodes[node].child; child >= 0; child = nodes[child].sibling)
+    {
+        struct Costs costs = node_total(child);
+
+        add_costs(&total, &costs);
+    }
+
+    return total;
+}
+
+static void print_costs(FILE *out, const struct Costs *costs)
+{
+    fprintf(out, " %10.1f %11lu %10lu %9.1f %9.1f",
+            costs->time * 1e3, costs->conversions, costs->spins, costs->delay * 1e3, costs->sleep * 1e3);
+}
+
+static void print_tree(FILE *out, int node, int level)
+{
+    char name [NAME_LENGTH];
+    struct Costs total = node_total(node);
+
+    fprintf(out, "%*s%-*s %9lu", 2 * level, "", 40 - 2 * level, symbol(nodes[node].function, name), nodes[node].calls);
+    print_costs(out, &total);
+    fprintf(out, "\n");
+
+    for (int child = nodes[node].child; child >= 0; child = nodes[child].sibling)
+    {
+        print_tree(out, child, level + 1);
+    }
+}
+
+struct Function
+{
+    void *function;
+    unsigned long calls;
+    struct Costs self;
+    struct Costs total;
+};
+
+static int compare_functions(const void *a, const void *b)
+{
+    double x = ((const struct Function *)a)->self.time;
+    double y = ((const struct Function *)b)->self.time;
+
+    return (x < y) - (x > y);
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+    double x = ((const struct Site *)a)->total.time;
+    double y = ((const struct Site *)b)->total.time;
+
+    return (x < y) - (x > y);
+}
+
+/* ================================
+Function: profile_report
+Paramaters: const char *path
+return type: none
+Description: Writes the profile of
+the mission to the file given: each
+function with what it did itself and
+with its callees, each call site with
+what the call did, and the call tree.
+Times are in ms of simulated time.
+Calls still running, such as main(),
+are counted up to now.
+================================ */
+void profile_report(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    struct Function *functions;
+    struct Site *sorted;
+    int function_count = 0;
+    int sorted_count = 0;
+
+    if (!out)
+    {
+        perror(path);
+        return;
+    }
+
+    charge_time();
+
+    for (int i = depth - 1; i >= 0; i--)
+    {
+        close_frame(&stack[i]);
+    }
+
+    functions = calloc(node_count + 1, sizeof(*functions));
+    sorted = calloc(site_count + 1, sizeof(*sorted));
+
+    if (!functions || !sorted)
+    {
+        perror("profile_report");
+        exit(1);
+    }
+
+    // Folds every path through the call tree into the function it ran. //
+    for (int node = 0; node < node_count; node++)
+    {
+        int i = 0;
+
+        while (i < function_count && functions[i].function != nodes[node].function)
+        {
+            i++;
+        }
+
+        if (i == function_count)
+        {
+            functions[function_count++].function = nodes[node].function;
+        }
+
+        functions[i].calls += nodes[node].calls;
+        add_costs(&functions[i].self, &nodes[node].self);
+    }
+
+    for (int site = 0; site < MAX_SITES; site++)
+    {
+        if (sites[site].call_site)
+        {
+            sorted[sorted_count++] = sites[site];
+
+            for (int i = 0; i < function_count; i++)
+            {
+                if (functions[i].function == sites[site].function)
+                {
+                    add_costs(&functions[i].total, &sites[site].total);
+                }
+            }
+        }
+    }
+
+    qsort(functions, function_count, sizeof(*functions), compare_functions);
+    qsort(sorted, sorted_count, sizeof(*sorted), compare_sites);
+
+    if (node_count == 0)
+    {
+        fprintf(out, "nothing was profiled, robot.c must be built with -finstrument-functions\n");
+    }
+    else
+    {
+        char name [NAME_LENGTH];
+        char caller [NAME_LENGTH];
+
+        fprintf(out, "%.1fms profiled, %lu conversions, %lu spins, %.1fms in _delay(), %.1fms asleep\n",
+                running.time * 1e3, running.conversions, running.spins, running.delay * 1e3, running.sleep * 1e3);
+
+        fprintf(out, "\nflat profile, by self time\n%-28s %9s %10s %10s %11s %10s %9s %9s\n",
+                "function", "calls", "total_ms", "self_ms", "conversions", "spins", "delay_ms", "sleep_ms");
+
+        for (int i = 0; i < function_count; i++)
+        {
+            fprintf(out, "%-28s %9lu %10.1f", symbol(functions[i].function, name), functions[i].calls, functions[i].total.time * 1e3);
+            print_costs(out, &functions[i].self);
+            fprintf(out, "\n");
+        }
+
+        fprintf(out, "\ncall sites, by total time\n%-32s %-28s %9s %10s %11s %10s %9s %9s\n",
+                "caller", "function", "calls", "total_ms", "conversions", "spins", "delay_ms", "sleep_ms");
+
+        for (int i = 0; i < sorted_count; i++)
+        {
+            fprintf(out, "%-32s %-28s %9lu", symbol(sorted[i].call_site, caller), symbol(sorted[i].function, name), sorted[i].calls);
+            print_costs(out, &sorted[i].total);
+            fprintf(out, "\n");
+        }
+
+        fprintf(out, "\ncall tree, with callees\n%-40s %9s %10s %11s %10s %9s %9s\n",
+                "function", "calls", "total_ms", "conversions", "spins", "delay_ms", "sleep_ms");
+
+        for (int node = roots; node >= 0; node = nodes[node].sibling)
+        {
+            print_tree(out, node, 0);
+        }
+    }
+
+    free(functions);
+    free(sorted);
+    fclose(out);
+}
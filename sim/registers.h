@@ -0,0 +1,138 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: registers.h
+Description: Layout of the simulated
+PIC16F690 special function registers,
+shared by the pic.h stand-in and the
+simulator.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#ifndef SIM_REGISTERS_H
+#define SIM_REGISTERS_H
+
+// REGISTER LAYOUTS //
+union SimOSCCON
+{
+    unsigned char byte;
+    struct { unsigned SCS:1; unsigned LTS:1; unsigned HTS:1; unsigned OSTS:1; unsigned IRCF:3; unsigned :1; } bits;
+};
+
+union SimPORTA
+{
+    unsigned char byte;
+    struct { unsigned RA0:1; unsigned RA1:1; unsigned RA2:1; unsigned RA3:1; unsigned RA4:1; unsigned RA5:1; unsigned :2; } bits;
+};
+
+union SimPORTB
+{
+    unsigned char byte;
+    struct { unsigned :4; unsigned RB4:1; unsigned RB5:1; unsigned RB6:1; unsigned RB7:1; } bits;
+};
+
+union SimPORTC
+{
+    unsigned char byte;
+    struct { unsigned RC0:1; unsigned RC1:1; unsigned RC2:1; unsigned RC3:1; unsigned RC4:1; unsigned RC5:1; unsigned RC6:1; unsigned RC7:1; } bits;
+};
+
+union SimINTCON
+{
+    unsigned char byte;
+    struct { unsigned RABIF:1; unsigned INTF:1; unsigned T0IF:1; unsigned RABIE:1; unsigned INTE:1; unsigned T0IE:1; unsigned PEIE:1; unsigned GIE:1; } bits;
+};
+
+union SimPIR1
+{
+    unsigned char byte;
+    struct { unsigned TMR1IF:1; unsigned TMR2IF:1; unsigned CCP1IF:1; unsigned SSPIF:1; unsigned TXIF:1; unsigned RCIF:1; unsigned ADIF:1; unsigned :1; } bits;
+};
+
+union SimPIE1
+{
+    unsigned char byte;
+    struct { unsigned TMR1IE:1; unsigned TMR2IE:1; unsigned CCP1IE:1; unsigned SSPIE:1; unsigned TXIE:1; unsigned RCIE:1; unsigned ADIE:1; unsigned :1; } bits;
+};
+
+union SimPIR2
+{
+    unsigned char byte;
+    struct { unsigned :4; unsigned EEIF:1; unsigned C1IF:1; unsigned C2IF:1; unsigned OSFIF:1; } bits;
+};
+
+union SimPIE2
+{
+    unsigned char byte;
+    struct { unsigned :4; unsigned EEIE:1; unsigned C1IE:1; unsigned C2IE:1; unsigned OSFIE:1; } bits;
+};
+
+union SimCM1CON0
+{
+    unsigned char byte;
+    struct { unsigned C1CH:2; unsigned C1R:1; unsigned :1; unsigned C1POL:1; unsigned C1OE:1; unsigned C1OUT:1; unsigned C1ON:1; } bits;
+};
+
+union SimADCON0
+{
+    unsigned char byte;
+    struct { unsigned ADON:1; unsigned GO:1; unsigned CHS:4; unsigned VCFG:1; unsigned ADFM:1; } bits;
+};
+
+union SimT1CON
+{
+    unsigned char byte;
+    struct { unsigned TMR1ON:1; unsigned TMR1CS:1; unsigned nT1SYNC:1; unsigned T1OSCEN:1; unsigned T1CKPS:2; unsigned TMR1GE:1; unsigned T1GINV:1; } bits;
+};
+
+union SimT2CON
+{
+    unsigned char byte;
+    struct { unsigned T2CKPS:2; unsigned TMR2ON:1; unsigned TOUTPS:4; unsigned :1; } bits;
+};
+
+struct SimRegisters
+{
+    union SimOSCCON osccon;
+    union SimPORTA porta;
+    union SimPORTB portb;
+    union SimPORTC portc;
+    unsigned char trisa;
+    unsigned char trisb;
+    unsigned char trisc;
+    unsigned char ansel;
+    unsigned char anselh;
+    union SimINTCON intcon;
+    union SimPIR1 pir1;
+    union SimPIE1 pie1;
+    union SimPIR2 pir2;
+    union SimPIE2 pie2;
+    union SimADCON0 adcon0;
+    unsigned char adcon1;
+    unsigned char adresh;
+    unsigned char adresl;
+    union SimT1CON t1con;
+    unsigned char tmr1l;
+    unsigned char tmr1h;
+    union SimT2CON t2con;
+    unsigned char pr2;
+    unsigned char tmr2;
+    unsigned char txsta;
+    unsigned char rcsta;
+    unsigned char baudctl;
+    unsigned char spbrg;
+    unsigned char spbrgh;
+    unsigned short txreg;      // Bit 8 is set while TXREG is empty, so writes by the firmware can be seen.
+    unsigned char ioca;
+    unsigned char vrcon;
+    union SimCM1CON0 cm1con0;
+    unsigned char wdtcon;
+};
+
+extern struct SimRegisters sim_regs;
+
+void sim_cycle(unsigned long cycles);
+void sim_delay(unsigned long cycles);
+void sim_nop(void);
+void sim_sleep(void);
+unsigned char sim_eeprom_read(unsigned char address);
+void sim_eeprom_write(unsigned char address, unsigned char value);
+
+#endif
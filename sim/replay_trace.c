@@ -0,0 +1,269 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: replay_trace.c
+Description: Feeds a trace robot.c
+sent with TRACE defined back through
+its own mission code, tick by tick,
+and checks it decides on the same
+steps and wheel speeds. A trace from
+the field becomes a test case that
+runs in a moment. Reads a capture
+file, or standard input.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "registers.h"
+
+// TRACE FORMAT, AS SENT BY send_trace() IN robot.c //
+#define TRACE_SYNC         0xA6
+#define TRACE_EEPROM_SIZE  19
+#define TRACE_INPUTS       0x08
+#define TRACE_MOTORS       0x10
+#define TRACE_STEP         0x20
+#define TRACE_EDGES        0x40
+#define TRACE_TICKS        0x80
+#define TRACE_ESCAPE       0x80
+#define TRACE_INPUT_BUTTON 0x01
+#define TRACE_INPUT_SUPPLY 0x02
+#define NUM_SENSORS        3
+#define NUM_TIMERS         1
+#define NUM_BARS           5
+#define IDLE               0
+
+// THE PARTS OF robot.c THE REPLAY DRIVES //
+extern volatile unsigned char samples [2][NUM_SENSORS];
+extern volatile unsigned char sample_front;
+extern volatile unsigned char sample_sequence;
+extern volatile unsigned int timers [NUM_TIMERS];
+extern volatile unsigned int bar_edges [2 * NUM_BARS];
+extern volatile unsigned char edge_count;
+extern volatile signed char right_speed;
+extern volatile signed char left_speed;
+extern unsigned char supply_scale;
+extern unsigned char step;
+extern unsigned char phase;
+
+void load_levels(void);
+void load_profile(void);
+void stop(void);
+void enter_step(unsigned char next);
+void step_mission(void);
+
+static const char *phase_names [] = {"waiting", "starting", "entering", "adjusting", "scanning", "delivering", "returning"};
+
+// The replay has no peripherals, so register accesses cost nothing and the EEPROM is a plain array. //
+struct SimRegisters sim_regs;
+static unsigned char eeprom [256];
+
+void sim_cycle(unsigned long cycles)
+{
+    (void)cycles;
+}
+
+void sim_delay(unsigned long cycles)
+{
+    (void)cycles;
+}
+
+void sim_nop(void)
+{
+}
+
+void sim_sleep(void)
+{
+}
+
+unsigned char sim_eeprom_read(unsigned char address)
+{
+    return eeprom[address];
+}
+
+void sim_eeprom_write(unsigned char address, unsigned char value)
+{
+    eeprom[address] = value;
+}
+
+// Returns the next byte of the trace, leaving the replay if it ends part way through a record. //
+static unsigned char next_byte(FILE *input, unsigned long tick)
+{
+    int c = getc(input);
+
+    if (c == EOF)
+    {
+        printf("trace ends part way through tick %lu\n", tick);
+        exit(1);
+    }
+
+    return c;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    int verbose = 0;
+    int c;
+    unsigned char readings [NUM_SENSORS] = {0};
+    unsigned char sent_edges = 0;
+    signed char expected_right = 0;
+    signed char expected_left = 0;
+    unsigned char expected_step = IDLE;
+    unsigned long tick = 0;
+    unsigned long steps = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    {
+        verbose = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [-v] [trace.bin]\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 2 && !(input = fopen(argv[1], "rb")))
+    {
+        perror(argv[1]);
+        return 2;
+    }
+
+    if (getc(input) != TRACE_SYNC)
+    {
+        fprintf(stderr, "not a trace, it should start with 0x%02X\n", TRACE_SYNC);
+        return 2;
+    }
+
+    // Power up from the same EEPROM as the robot did. //
+    memset(eeprom, 0xFF, sizeof(eeprom));
+
+    for (int i = 0; i < TRACE_EEPROM_SIZE; i++)
+    {
+        eeprom[i] = next_byte(input, 0);
+    }
+
+    load_levels();
+    load_profile();
+    stop();
+    enter_step(IDLE);
+
+    while ((c = getc(input)) != EOF)
+    {
+        unsigned char flags = c;
+        unsigned char ticks = (flags & TRACE_TICKS) ? next_byte(input, tick) : 1;
+        unsigned char inputs = 0;
+
+        tick++;
+
+        for (int i = 0; i < NUM_SENSORS; i++)
+        {
+            if (flags & (1 << i))
+            {
+                unsigned char change = next_byte(input, tick);
+
+                readings[i] = (change == TRACE_ESCAPE) ? next_byte(input, tick) : readings[i] + (signed char)change;
+            }
+        }
+
+        if (flags & TRACE_INPUTS)
+        {
+            inputs = next_byte(input, tick);
+
+            if (inputs & TRACE_INPUT_SUPPLY)
+            {
+                supply_scale = next_byte(input, tick);
+            }
+        }
+
+        if (flags & TRACE_MOTORS)
+        {
+            expected_right = next_byte(input, tick);
+            expected_left = next_byte(input, tick);
+        }
+
+        if (flags & TRACE_STEP)
+        {
+            expected_step = next_byte(input, tick);
+        }
+
+        if (flags & TRACE_EDGES)
+        {
+            unsigned char edges = next_byte(input, tick);
+
+            // The count drops back when a new barcode capture starts. //
+            if (edges < sent_edges)
+            {
+                sent_edges = 0;
+            }
+
+            for (; sent_edges < edges && sent_edges < 2 * NUM_BARS; sent_edges++)
+            {
+                unsigned char high = next_byte(input, tick);
+
+                bar_edges[sent_edges] = (high << 8) | next_byte(input, tick);
+            }
+
+            edge_count = edges;
+        }
+
+        // Stand in for the interrupts that ran before the step. //
+        for (int i = 0; i < ticks; i++)
+        {
+            for (int j = 0; j < NUM_TIMERS; j++)
+            {
+                if (timers[j] > 0)
+                {
+                    timers[j]--;
+                }
+            }
+        }
+
+        for (int i = 0; i < NUM_SENSORS; i++)
+        {
+            samples[sample_front][i] = readings[i];
+        }
+
+        sample_sequence++;
+        sim_regs.porta.bits.RA5 = (inputs & TRACE_INPUT_BUTTON) != 0;
+
+        {
+            unsigned char before = step;
+
+            step_mission();
+
+            if (step != before)
+            {
+                steps++;
+
+                if (verbose)
+                {
+                    printf("tick %lu: step %d, %s\n", tick, step, phase_names[phase]);
+                }
+            }
+        }
+
+        if (step != expected_step || right_speed != expected_right || left_speed != expected_left)
+        {
+            printf("tick %lu: replay decided step %d at %d,%d but the robot decided step %d at %d,%d\n",
+                   tick, step, right_speed, left_speed, expected_step, expected_right, expected_left);
+            return 1;
+        }
+    }
+
+    printf("%lu ticks replayed, %lu steps entered, every decision matches\n", tick, steps);
+
+    if (step != IDLE)
+    {
+        printf("trace ends in step %d, %s\n", step, phase_names[phase]);
+    }
+
+    if (input != stdin)
+    {
+        fclose(input);
+    }
+
+    return 0;
+}
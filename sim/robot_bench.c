@@ -0,0 +1,130 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: robot_bench.c
+Description: Runs the mission to
+every destination at each speed
+given and prints one CSV row per
+run with the time spent in every
+phase, so lap times can be compared
+between builds of robot.c.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+// Phases reported, named after the routines of the original mission. //
+static const char *phase_names [SIM_PHASES] =
+{
+    NULL,               // WAITING
+    "start",            // STARTING
+    "enter",            // ENTERING
+    "adjust_position",  // ADJUSTING
+    "scan_barcode",     // SCANNING
+    "go_to_destination",// DELIVERING
+    "go_home"           // RETURNING
+};
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-s seed] [-n noise] [speed ...]\n", program);
+    exit(2);
+}
+
+static void print_header(void)
+{
+    printf("destination,speed,seed,success,decoded,delivered,returned,mission_time");
+
+    for (int i = 0; i < SIM_PHASES; i++)
+    {
+        if (phase_names[i])
+        {
+            printf(",%s", phase_names[i]);
+        }
+    }
+
+    printf(",conversions,delay_time,spin_time,sleep_time\n");
+}
+
+static void print_run(const struct SimConfig *config, const struct SimResult *result, int success)
+{
+    printf("%d,%.2f,%lu,%d,%d,%d,%d,%.3f",
+           config->destination, config->speed_scale, config->seed,
+           success, result->decoded, result->delivered, result->returned,
+           result->completed ? result->mission_time : config->time_limit);
+
+    for (int i = 0; i < SIM_PHASES; i++)
+    {
+        if (phase_names[i])
+        {
+            printf(",%.3f", result->phase_time[i]);
+        }
+    }
+
+    printf(",%lu,%.3f,%.3f,%.3f\n", result->conversions, result->delay_time, result->spin_time, result->sleep_time);
+}
+
+int main(int argc, char **argv)
+{
+    struct SimConfig config;
+    struct SimResult result;
+    double speeds [16];
+    int num_speeds = 0;
+
+    sim_default_config(&config);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (strlen(argv[i]) != 2 || i + 1 >= argc)
+            {
+                usage(argv[0]);
+            }
+
+            switch (argv[i][1])
+            {
+                case 's':
+                    config.seed = strtoul(argv[++i], NULL, 0);
+                    break;
+
+                case 'n':
+                    config.sensor_noise = atof(argv[++i]);
+                    break;
+
+                default:
+                    usage(argv[0]);
+            }
+        }
+        else if (num_speeds < 16)
+        {
+            speeds[num_speeds++] = atof(argv[i]);
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    if (num_speeds == 0)
+    {
+        speeds[num_speeds++] = 1.0;
+    }
+
+    print_header();
+
+    for (int s = 0; s < num_speeds; s++)
+    {
+        for (int d = 0; d < 4; d++)
+        {
+            config.destination = d;
+            config.speed_scale = speeds[s];
+
+            print_run(&config, &result, sim_run(&config, &result));
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
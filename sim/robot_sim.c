@@ -0,0 +1,207 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: robot_sim.c
+Description: Runs one mission of
+robot.c in the simulator and prints
+what the robot did.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-d destination] [-b destinations] [-s seed] [-n noise] [-l light] [-m mismatch]\n"
+            "          [-v speed] [-x mm] [-y mm] [-a degrees] [-T seconds] [-t trace.csv]\n"
+            "          [-e eeprom.bin] [-u telemetry.bin] [-p profile.txt]\n",
+            program);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct SimConfig config;
+    struct SimResult result;
+    int ok;
+
+    sim_default_config(&config);
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (argv[i][0] != '-' || strlen(argv[i]) != 2 || !value)
+        {
+            usage(argv[0]);
+        }
+
+        switch (argv[i][1])
+        {
+            case 'd':
+                config.destination = atoi(value);
+                break;
+
+            case 'b':
+                // Further destinations for a multi-drop barcode, as digits such as 13. //
+                for (const char *digit = value; *digit; digit++)
+                {
+                    if (*digit < '0' || *digit > '3')
+                    {
+                        usage(argv[0]);
+                    }
+
+                    config.extra_stops |= 1 << (*digit - '0');
+                }
+                break;
+
+            case 's':
+                config.seed = strtoul(value, NULL, 0);
+                break;
+
+            case 'n':
+                config.sensor_noise = atof(value);
+                break;
+
+            case 'l':
+                config.light_offset = atof(value);
+                break;
+
+            case 'm':
+                config.motor_mismatch = atof(value);
+                break;
+
+            case 'v':
+                config.speed_scale = atof(value);
+                break;
+
+            case 'x':
+                config.start_x = atof(value);
+                break;
+
+            case 'y':
+                config.start_y = atof(value);
+                break;
+
+            case 'a':
+                config.start_heading = atof(value);
+                break;
+
+            case 'T':
+                config.time_limit = atof(value);
+                break;
+
+            case 't':
+                config.trace_path = value;
+                break;
+
+            case 'u':
+                config.telemetry_path = value;
+                break;
+
+            case 'e':
+                config.eeprom_path = value;
+                break;
+
+            case 'p':
+                config.profile_path = value;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+
+        i++;
+    }
+
+    if (config.destination < 0 || config.destination > 3)
+    {
+        usage(argv[0]);
+    }
+
+    ok = sim_run(&config, &result);
+
+    for (int i = 0; i < result.rests; i++)
+    {
+        printf("rest %6.2fs at (%6.1f, %6.1f) in %s\n",
+               result.rest[i].time, result.rest[i].x, result.rest[i].y, field_zone_name(result.rest[i].zone));
+    }
+
+    printf("destination %d", config.destination);
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (config.extra_stops & ~(1 << config.destination) & (1 << i))
+        {
+            printf(" and %d", i);
+        }
+    }
+
+    printf(": decoded %d, %s, %s\n",
+           result.decoded,
+           result.delivered ? "delivered" : "not delivered",
+           result.returned ? "returned home" : "not home");
+
+    if (result.delivered)
+    {
+        printf("delivered after %.2fs\n", result.delivered_time);
+    }
+
+    // Only a build with LATENCY_HISTOGRAM times its steps. //
+    if (result.timed)
+    {
+        // Bucket i holds steps shorter than 32us << i, the last one everything longer. //
+        printf("step time:");
+
+        for (int i = 0; i < SIM_LATENCY_BUCKETS; i++)
+        {
+            if (i < SIM_LATENCY_BUCKETS - 1)
+            {
+                printf(" <%dus %lu", 32 << i, result.latency_counts[i]);
+            }
+            else
+            {
+                printf(" >=%dus %lu", 32 << (i - 1), result.latency_counts[i]);
+            }
+        }
+
+        printf(", %u overruns\nlongest step:", result.latency_overruns);
+
+        for (int i = 1; i < SIM_PHASES; i++)
+        {
+            printf(" %.0fus", result.latency_max[i] * 1e6);
+        }
+
+        printf(" by phase\n");
+    }
+
+    if (result.serial_bytes)
+    {
+        printf("%lu bytes of telemetry sent\n", result.serial_bytes);
+    }
+
+    if (result.sleep_time > 0)
+    {
+        printf("asleep for %.2fs\n", result.sleep_time);
+    }
+
+    if (result.eeprom_writes)
+    {
+        printf("%d EEPROM bytes written\n", result.eeprom_writes);
+    }
+
+    if (result.completed)
+    {
+        printf("mission time %.2fs, %lu ADC conversions, %.0fx real time\n",
+               result.mission_time, result.conversions,
+               (result.mission_time + config.button_time) / (result.host_time > 0 ? result.host_time : 1e-6));
+    }
+    else
+    {
+        printf("did not finish within %.0fs\n", config.time_limit);
+    }
+
+    return ok ? 0 : 1;
+}
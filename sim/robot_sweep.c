@@ -0,0 +1,253 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: robot_sweep.c
+Description: Runs thousands of
+missions of one build of robot.c on
+every core, each with its own sensor
+noise, lighting, motor mismatch,
+start pose and destination, and
+prints one CSV row with the success
+rate, the spread of mission times and
+the phase the failed runs went wrong
+in. make sweep builds it once for
+every combination of tuning values.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+// RANGES THE RUNS ARE DRAWN FROM //
+#define NOISE_MIN         0.5    // Sensor noise in 8 bit ADC counts.
+#define NOISE_MAX         3.0
+#define LIGHT_RANGE       8.0    // Largest ambient light offset either way in 8 bit ADC counts.
+#define MISMATCH_RANGE    0.05   // Largest fraction either motor runs faster than the other.
+#define POSE_RANGE        10.0   // Largest start position offset either way in mm.
+#define HEADING_RANGE     5.0    // Largest start heading offset either way in degrees.
+
+struct Run
+{
+    int done;                  // Set by the worker once the run has been made.
+    int success;
+    int last_phase;            // enum Phase of robot.c the run ended in or went wrong in.
+    double mission_time;       // Time in s after the button press the robot stopped for good.
+};
+
+// Phases reported, named after the routines of the original mission. //
+static const char *phase_names [SIM_PHASES] = {"waiting", "start", "enter", "adjust_position", "scan_barcode", "go_to_destination", "go_home"};
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-r runs] [-j workers] [-s seed] [-v speed] [-T seconds] [-l label]\n"
+            "       %s -H\n",
+            program, program);
+    exit(2);
+}
+
+static void print_header(void)
+{
+    printf("hysteresis,wide_bar_ratio,enter_exit_time,speed,runs,successes,success_rate,time_min,time_median,time_p90,time_max");
+
+    for (int i = 0; i < SIM_PHASES; i++)
+    {
+        printf(",failed_%s", phase_names[i]);
+    }
+
+    printf("\n");
+}
+
+// Uniform number in [low, high) that only depends on the seed, run and draw, so no two workers share a sequence. //
+static double draw(unsigned long seed, int run, int number, double low, double high)
+{
+    unsigned long long x = seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)run * 0xBF58476D1CE4E5B9ULL + number;
+
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+
+    return low + (high - low) * (x >> 11) / 9007199254740992.0;
+}
+
+static void make_run(const struct SimConfig *base, int run, struct Run *out)
+{
+    struct SimConfig config = *base;
+    struct SimResult result;
+    unsigned long seed = base->seed;
+
+    config.destination = run % 4;
+    config.seed = seed + run;
+    config.sensor_noise = draw(seed, run, 0, NOISE_MIN, NOISE_MAX);
+    config.light_offset = draw(seed, run, 1, -LIGHT_RANGE, LIGHT_RANGE);
+    config.motor_mismatch = draw(seed, run, 2, -MISMATCH_RANGE, MISMATCH_RANGE);
+    config.start_x = draw(seed, run, 3, -POSE_RANGE, POSE_RANGE);
+    config.start_y = draw(seed, run, 4, -POSE_RANGE, POSE_RANGE);
+    config.start_heading = draw(seed, run, 5, -HEADING_RANGE, HEADING_RANGE);
+
+    out->success = sim_run(&config, &result);
+    out->last_phase = result.last_phase;
+    out->mission_time = result.mission_time;
+    out->done = 1;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    struct SimConfig config;
+    struct Run *runs;
+    double *times;
+    const char *label = ",,";
+    int num_runs = 1000;
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int successes = 0;
+    int failures [SIM_PHASES] = {0};
+
+    sim_default_config(&config);
+    config.time_limit = 60.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "-H") == 0)
+        {
+            print_header();
+            return 0;
+        }
+
+        if (argv[i][0] != '-' || strlen(argv[i]) != 2 || !value)
+        {
+            usage(argv[0]);
+        }
+
+        switch (argv[i][1])
+        {
+            case 'r':
+                num_runs = atoi(value);
+                break;
+
+            case 'j':
+                workers = atoi(value);
+                break;
+
+            case 's':
+                config.seed = strtoul(value, NULL, 0);
+                break;
+
+            case 'v':
+                config.speed_scale = atof(value);
+                break;
+
+            case 'T':
+                config.time_limit = atof(value);
+                break;
+
+            case 'l':
+                label = value;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+
+        i++;
+    }
+
+    if (num_runs < 1 || workers < 1)
+    {
+        usage(argv[0]);
+    }
+
+    // The workers write their results straight into memory shared with this process. //
+    runs = mmap(NULL, num_runs * sizeof(*runs), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    times = malloc(num_runs * sizeof(*times));
+
+    if (runs == MAP_FAILED || !times)
+    {
+        perror("robot_sweep");
+        return 1;
+    }
+
+    memset(runs, 0, num_runs * sizeof(*runs));
+    fflush(NULL);
+
+    for (int w = 0; w < workers; w++)
+    {
+        pid_t child = fork();
+
+        if (child < 0)
+        {
+            perror("robot_sweep");
+            return 1;
+        }
+
+        if (child == 0)
+        {
+            // sim_run() makes every mission in a process of its own, so a worker only hands them out. //
+            for (int run = w; run < num_runs; run += workers)
+            {
+                make_run(&config, run, &runs[run]);
+            }
+
+            _exit(0);
+        }
+    }
+
+    // robot.c has a wait() of its own, so waitpid() it is. //
+    while (waitpid(-1, NULL, 0) > 0)
+    {
+    }
+
+    for (int run = 0; run < num_runs; run++)
+    {
+        if (!runs[run].done)
+        {
+            fprintf(stderr, "robot_sweep: run %d was not made\n", run);
+            return 1;
+        }
+
+        if (runs[run].success)
+        {
+            times[successes++] = runs[run].mission_time;
+        }
+        else if (runs[run].last_phase >= 0 && runs[run].last_phase < SIM_PHASES)
+        {
+            failures[runs[run].last_phase]++;
+        }
+    }
+
+    qsort(times, successes, sizeof(*times), compare_times);
+
+    printf("%s,%.2f,%d,%d,%.3f", label, config.speed_scale, num_runs, successes, (double)successes / num_runs);
+
+    if (successes > 0)
+    {
+        printf(",%.2f,%.2f,%.2f,%.2f", times[0], times[successes / 2], times[successes * 9 / 10], times[successes - 1]);
+    }
+    else
+    {
+        printf(",,,,");
+    }
+
+    for (int i = 0; i < SIM_PHASES; i++)
+    {
+        printf(",%d", failures[i]);
+    }
+
+    printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,301 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: robot_test.c
+Description: Unit tests of the
+decisions robot.c makes from its
+sensors and the barcode, calling its
+functions directly the way
+replay_trace does. Exits non-zero at
+the first check that fails.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "registers.h"
+
+// THE PARTS OF robot.c UNDER TEST //
+#define NUM_BARS          5
+#define NUM_DESTINATIONS  4
+
+enum Sensor {RIGHT_SENSOR, CENTRE_SENSOR, LEFT_SENSOR, NUM_SENSORS};
+enum Direction {RIGHT, LEFT};
+enum Section {HOME_SECTION, DEST1_SECTION, DEST3_SECTION, BARCODE_SECTION, DEST2_SECTION, DEST0_SECTION, NUM_SECTIONS};
+
+struct Junction
+{
+    unsigned int position;
+    unsigned char marker;
+};
+
+extern const struct Junction field [NUM_SECTIONS];
+extern const unsigned char destination_section [NUM_DESTINATIONS];
+
+extern unsigned char white_level [NUM_SENSORS];
+extern unsigned char black_level [NUM_SENSORS];
+extern unsigned char low_threshold [NUM_SENSORS];
+extern unsigned char high_threshold [NUM_SENSORS];
+extern char sensor_black [NUM_SENSORS];
+extern char last_black;
+extern signed char marker_count;
+extern signed char markers_to_destination;
+extern enum Direction direction;
+extern unsigned char route [NUM_DESTINATIONS];
+extern unsigned char route_length;
+extern volatile unsigned int bar_edges [2 * NUM_BARS];
+extern volatile unsigned char edge_count;
+
+void set_thresholds(void);
+void update_colour(enum Sensor side, unsigned char reading);
+char black(enum Sensor side);
+char count_edge(enum Sensor side);
+unsigned char wide_bars(void);
+void plan_route(unsigned char from, unsigned char to, char stop_on_marker);
+void order_stops(unsigned char stops);
+unsigned char next_section(unsigned char section);
+
+// The tests have no peripherals, so register accesses cost nothing and the EEPROM is a plain array. //
+struct SimRegisters sim_regs;
+static unsigned char eeprom [256];
+
+void sim_cycle(unsigned long cycles)
+{
+    (void)cycles;
+}
+
+void sim_delay(unsigned long cycles)
+{
+    (void)cycles;
+}
+
+void sim_nop(void)
+{
+}
+
+void sim_sleep(void)
+{
+}
+
+unsigned char sim_eeprom_read(unsigned char address)
+{
+    return eeprom[address];
+}
+
+void sim_eeprom_write(unsigned char address, unsigned char value)
+{
+    eeprom[address] = value;
+}
+
+// A colour only changes once the reading has crossed the whole hysteresis band. //
+static void test_update_colour(void)
+{
+    white_level[RIGHT_SENSOR] = 20;
+    black_level[RIGHT_SENSOR] = 90;
+    set_thresholds();
+    sensor_black[RIGHT_SENSOR] = 0;
+
+    assert(low_threshold[RIGHT_SENSOR] < 55 && high_threshold[RIGHT_SENSOR] > 55);
+
+    update_colour(RIGHT_SENSOR, 55);
+    assert(!black(RIGHT_SENSOR));
+
+    update_colour(RIGHT_SENSOR, high_threshold[RIGHT_SENSOR]);
+    assert(!black(RIGHT_SENSOR));
+
+    update_colour(RIGHT_SENSOR, high_threshold[RIGHT_SENSOR] + 1);
+    assert(black(RIGHT_SENSOR));
+
+    update_colour(RIGHT_SENSOR, 55);
+    assert(black(RIGHT_SENSOR));
+
+    update_colour(RIGHT_SENSOR, low_threshold[RIGHT_SENSOR]);
+    assert(black(RIGHT_SENSOR));
+
+    update_colour(RIGHT_SENSOR, low_threshold[RIGHT_SENSOR] - 1);
+    assert(!black(RIGHT_SENSOR));
+}
+
+// Only the sensor moving onto a line counts, staying on it or leaving it does not. //
+static void test_count_edge(void)
+{
+    const char colours [] = {0, 1, 1, 0, 0, 1};
+    const signed char counts [] = {0, 1, 1, 1, 1, 2};
+
+    marker_count = 0;
+    markers_to_destination = 2;
+    last_black = 0;
+
+    for (unsigned int i = 0; i < sizeof(colours); i++)
+    {
+        sensor_black[LEFT_SENSOR] = colours[i];
+
+        assert(count_edge(LEFT_SENSOR) == (counts[i] >= 2));
+        assert(marker_count == counts[i]);
+    }
+
+    // A step entered with the sensor already on a line does not count that line. //
+    marker_count = 0;
+    markers_to_destination = 1;
+    last_black = 1;
+    sensor_black[LEFT_SENSOR] = 1;
+    assert(!count_edge(LEFT_SENSOR));
+}
+
+// Fills bar_edges with bars of the widths given in Timer1 counts, starting at the time given. //
+static void cross_bars(unsigned int start, const unsigned int widths [NUM_BARS])
+{
+    unsigned int time = start;
+
+    for (int i = 0; i < NUM_BARS; i++)
+    {
+        bar_edges[2 * i] = time;
+        bar_edges[2 * i + 1] = (time + widths[i]) & 0xFFFF;
+        time = (time + widths[i] + 300) & 0xFFFF;
+    }
+
+    edge_count = 2 * NUM_BARS;
+}
+
+// Bars are wide by their time against the first bar, and the edge times may wrap. //
+static void test_wide_bars(void)
+{
+    const unsigned int narrow [NUM_BARS] = {100, 100, 100, 100, 100};
+    const unsigned int stops_1_3 [NUM_BARS] = {100, 100, 400, 100, 400};
+    const unsigned int all [NUM_BARS] = {100, 400, 400, 400, 400};
+
+    cross_bars(1000, stops_1_3);
+    edge_count = 2 * NUM_BARS - 1;
+    assert(wide_bars() == 0);
+
+    cross_bars(1000, narrow);
+    assert(wide_bars() == 0);
+
+    cross_bars(1000, stops_1_3);
+    assert(wide_bars() == 0x0A);
+
+    cross_bars(0xFF00, stops_1_3);
+    assert(wide_bars() == 0x0A);
+
+    cross_bars(1000, all);
+    assert(wide_bars() == 0x0F);
+}
+
+// The shorter way round is taken, counting the markers passed and the one stopped on. //
+static void test_plan_route(void)
+{
+    plan_route(BARCODE_SECTION, DEST2_SECTION, 1);
+    assert(direction == RIGHT && markers_to_destination == 1 && marker_count == 0);
+
+    plan_route(BARCODE_SECTION, DEST1_SECTION, 1);
+    assert(direction == LEFT && markers_to_destination == 2);
+
+    plan_route(BARCODE_SECTION, DEST0_SECTION, 1);
+    assert(direction == RIGHT && markers_to_destination == 2);
+
+    plan_route(BARCODE_SECTION, DEST3_SECTION, 1);
+    assert(direction == LEFT && markers_to_destination == 1);
+
+    // Home is across the field from the barcode, so each destination goes on round the way it was reached. //
+    plan_route(DEST0_SECTION, HOME_SECTION, 0);
+    assert(direction == RIGHT && markers_to_destination == 0);
+
+    plan_route(DEST2_SECTION, HOME_SECTION, 0);
+    assert(direction == RIGHT && markers_to_destination == 1);
+
+    plan_route(DEST1_SECTION, HOME_SECTION, 0);
+    assert(direction == LEFT && markers_to_destination == 0);
+
+    plan_route(DEST3_SECTION, HOME_SECTION, 0);
+    assert(direction == LEFT && markers_to_destination == 1);
+
+    plan_route(HOME_SECTION, BARCODE_SECTION, 0);
+    assert(direction == RIGHT && markers_to_destination == 2);
+}
+
+// Every stop is visited once, in the order making the trip from the barcode round them and home shortest. //
+static void test_order_stops(void)
+{
+    for (unsigned char stops = 1; stops < 1 << NUM_DESTINATIONS; stops++)
+    {
+        unsigned char seen = 0;
+
+        order_stops(stops);
+
+        assert(route_length == __builtin_popcount(stops));
+
+        for (unsigned char i = 0; i < route_length; i++)
+        {
+            assert(!(seen & (1 << route[i])));
+            seen |= 1 << route[i];
+        }
+
+        assert(seen == stops);
+    }
+
+    // Going east to 2 and 0 first leaves the short way home past 3 and 1. //
+    order_stops(0x0F);
+    assert(route[0] == 2 && route[1] == 0 && route[2] == 3 && route[3] == 1);
+
+    order_stops(0x0A);
+    assert(route[0] == 3 && route[1] == 1);
+}
+
+// Walks the perimeter from the section given the way plan_route() set, passing markers_to_destination markers, and returns //
+// the section the robot stops at. One that is not stopping on a marker goes on to the next section, where BOTH_BLACK ends it. //
+static unsigned char walk_route(unsigned char from, char stop_on_marker)
+{
+    unsigned char section = from;
+    signed char markers = 0;
+
+    for (int i = 0; markers < markers_to_destination; i++)
+    {
+        assert(i < NUM_SECTIONS);
+
+        section = next_section(section);
+        markers += field[section].marker;
+    }
+
+    return stop_on_marker ? section : next_section(section);
+}
+
+// Every route planned for a barcode reaches the barcode, each of its stops in turn and then home. //
+static void test_routes_get_home(void)
+{
+    plan_route(HOME_SECTION, BARCODE_SECTION, 0);
+    assert(walk_route(HOME_SECTION, 0) == BARCODE_SECTION);
+
+    for (unsigned char stops = 1; stops < 1 << NUM_DESTINATIONS; stops++)
+    {
+        unsigned char from = BARCODE_SECTION;
+
+        order_stops(stops);
+
+        for (unsigned char i = 0; i < route_length; i++)
+        {
+            unsigned char to = destination_section[route[i]];
+
+            plan_route(from, to, 1);
+            assert(walk_route(from, 1) == to);
+            from = to;
+        }
+
+        plan_route(from, HOME_SECTION, 0);
+        assert(walk_route(from, 0) == HOME_SECTION);
+    }
+}
+
+int main(void)
+{
+    memset(eeprom, 0xFF, sizeof(eeprom));
+
+    test_update_colour();
+    test_count_edge();
+    test_wide_bars();
+    test_plan_route();
+    test_order_stops();
+    test_routes_get_home();
+
+    printf("every unit test passed\n");
+
+    return 0;
+}
@@ -0,0 +1,966 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: sim.c
+Description: Runs robot.c against a
+model of the PIC16F690 peripherals,
+a differential drive robot and its
+reflectance sensors on the playing
+field. Time is counted in instruction
+cycles of the 8MHz internal clock.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "registers.h"
+#include "sim.h"
+
+// CLOCK //
+#define CYCLES_PER_SECOND 2000000.0 // Instruction clock of the 8MHz internal oscillator.
+#define PHYSICS_CYCLES    1000      // Instruction cycles between updates of the robot model.
+#define ISR_CYCLES        20        // Cycles to enter and leave the interrupt handler.
+#define TRACE_CYCLES      20000     // Instruction cycles between trace records.
+#define DELAY_CYCLES      100       // Longest step of a _delay() between interrupt checks.
+#define EEPROM_CYCLES     10000     // Instruction cycles a data EEPROM write takes, 5ms at most.
+#define EEPROM_SIZE       256
+#define ACQUISITION_TAU   3.0       // Time constant in cycles of the ADC hold capacitor, the 11.5us TACQ is 7.6 of them.
+#define LFINTOSC          31000.0   // Clock of the watchdog in Hz.
+
+// ROBOT MODEL //
+#define WHEEL_BASE        120.0     // Distance between the wheels in mm.
+#define SENSOR_FORWARD    60.0      // Distance of the sensors ahead of the axle in mm.
+#define SENSOR_SPACING    20.0      // Distance between neighbouring sensors in mm.
+#define SENSOR_SPOT       10.0      // Width of the patch of field each sensor sees in mm.
+#define WHEEL_SPEED       170.0     // Speed of a wheel at full duty in mm/s.
+#define MOTOR_LAG         0.04      // Time constant of the motors in s.
+#define WHITE_LEVEL       20.0      // Reading over the white board in 8 bit ADC counts.
+#define BLACK_LEVEL       90.0      // Reading over a black line in 8 bit ADC counts.
+#define SUPPLY_VOLTS      5.0       // Supply of a fresh battery, scaled by speed_scale like the wheel speeds.
+#define REFERENCE_VOLTS   0.6       // Fixed reference on ADC channel 13.
+
+// RUN CONTROL //
+#define REST_TIME         0.8       // Time in s the motors must be off to count as a rest.
+#define FINISH_TIME       3.0       // Time in s the motors must be off to end the run.
+#define BUTTON_HOLD       0.2       // Time in s the start button is held down.
+
+struct SimRegisters sim_regs;
+
+void isr(void);
+void robot_main(void);
+
+extern unsigned char phase;
+// Only there when robot.c is built with LATENCY_HISTOGRAM, so weak to leave them NULL otherwise. //
+extern unsigned char latency_counts [SIM_LATENCY_BUCKETS] __attribute__((weak));
+extern unsigned char latency_max [SIM_PHASES] __attribute__((weak));
+extern unsigned char latency_overruns __attribute__((weak));
+
+static struct
+{
+    struct SimConfig config;
+    struct SimResult *result;
+    jmp_buf exit;
+
+    unsigned long long cycles;
+    unsigned long long next_physics;
+    unsigned long long next_trace;
+    unsigned long long next_tick;
+    unsigned long long timer1_start;
+    int timer1_running;
+    unsigned long long adc_done;
+    int adc_busy;
+    int adc_channel;          // Channel the hold capacitor is connected to.
+    unsigned long long adc_settled; // Cycle the hold capacitor started charging towards that channel.
+    double adc_hold;          // Voltage on the hold capacitor in 10 bit ADC counts.
+    int reading [16];         // Last conversion of each analogue channel for the trace.
+    int tick_running;
+    int in_isr;
+    int finished;
+    int tx_busy;
+    unsigned char tx_shift;   // Byte in the transmit shift register.
+    unsigned long long tx_done; // Cycle the byte in the shift register has been sent.
+    FILE *telemetry;
+    unsigned char eeprom [EEPROM_SIZE];
+    unsigned long long eeprom_done; // Cycle the EEPROM write in progress finishes.
+
+    double x;
+    double y;
+    double heading;
+    double right_speed;
+    double left_speed;
+    double right_gain;
+    double left_gain;
+    int moved;
+    double last_moving;
+    int resting;
+    int visited;              // Mask of the destination sections the robot has rested in.
+
+    unsigned long long random;
+    FILE *trace;
+} sim;
+
+// Uniform random number in [0, 1) from a xorshift generator. //
+static double uniform(void)
+{
+    sim.random ^= sim.random << 13;
+    sim.random ^= sim.random >> 7;
+    sim.random ^= sim.random << 17;
+
+    return (sim.random >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double gaussian(void)
+{
+    double u = uniform();
+    double v = uniform();
+
+    if (u < 1e-12)
+    {
+        u = 1e-12;
+    }
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* ================================
+Function: sim_time
+Paramaters: none
+return type: double
+Description: Returns the simulated
+time in s since power up.
+================================ */
+double sim_time(void)
+{
+    return sim.cycles / CYCLES_PER_SECOND;
+}
+
+// Position of a sensor in mm, side is 1 for the right sensor, 0 for the centre one and -1 for the left one. //
+static void sensor_position(int side, double *x, double *y)
+{
+    double angle = sim.heading * M_PI / 180.0;
+    double lateral = side * SENSOR_SPACING;
+
+    *x = sim.x + SENSOR_FORWARD * cos(angle) + lateral * sin(angle);
+    *y = sim.y + SENSOR_FORWARD * sin(angle) - lateral * cos(angle);
+}
+
+// Reading of a sensor in 10 bit ADC counts. //
+static int sensor_reading(int side)
+{
+    double x;
+    double y;
+    double black;
+    double level;
+
+    sensor_position(side, &x, &y);
+
+    black = field_reflectance(x, y, SENSOR_SPOT);
+
+    level = WHITE_LEVEL + black * (BLACK_LEVEL - WHITE_LEVEL) + sim.config.light_offset + gaussian() * sim.config.sensor_noise;
+    level *= 4;
+
+    if (level < 0)
+    {
+        level = 0;
+    }
+    else if (level > 1023)
+    {
+        level = 1023;
+    }
+
+    return (int)level;
+}
+
+// Reading of the analogue channel given in 10 bit ADC counts. //
+static int channel_reading(int channel)
+{
+    switch (channel)
+    {
+        case 1:
+            return sensor_reading(1);
+
+        case 2:
+            return sensor_reading(-1);
+
+        case 3:
+            return sensor_reading(0);
+
+        // The ADC is referenced to the supply, so the fixed reference reads higher as the battery drains. //
+        case 13:
+            if (!(sim_regs.vrcon & 0x10))
+            {
+                return 0;
+            }
+
+            return (int)(REFERENCE_VOLTS / (SUPPLY_VOLTS * sim.config.speed_scale) * 1023 + 0.5);
+
+        default:
+            return 0;
+    }
+}
+
+// Instruction cycles per ADC clock period for the ADCS setting in ADCON1. //
+static unsigned long adc_period(void)
+{
+    static const unsigned long period [8] = {1, 2, 8, 8, 1, 4, 16, 8};
+
+    return period[(sim_regs.adcon1 >> 4) & 7];
+}
+
+// Instruction cycles per Timer2 interrupt for the current T2CON and PR2. //
+static unsigned long tick_period(void)
+{
+    static const unsigned long prescale [4] = {1, 4, 16, 16};
+
+    return prescale[sim_regs.t2con.bits.T2CKPS] * (sim_regs.pr2 + 1UL) * (sim_regs.t2con.bits.TOUTPS + 1UL);
+}
+
+// Instruction cycles per bit for the EUSART baud rate settings. //
+static unsigned long serial_bit_period(void)
+{
+    int brg16 = (sim_regs.baudctl >> 3) & 1;
+    int brgh = (sim_regs.txsta >> 2) & 1;
+    unsigned long divisor = (brg16 ? ((sim_regs.spbrgh << 8) | sim_regs.spbrg) : sim_regs.spbrg) + 1UL;
+
+    // The baud rate is Fosc / (64, 16 or 4 times the divisor), and an instruction is 4 Fosc clocks. //
+    return divisor * ((brg16 && brgh) ? 1 : (brg16 || brgh) ? 4 : 16);
+}
+
+// With the serial port on, RB5 and RB7 belong to the EUSART and those motor lines are wired to RC6 and RC7. //
+static int serial_on(void)
+{
+    return (sim_regs.rcsta & 0x80) != 0;
+}
+
+static int right_reverse_pin(void)
+{
+    return serial_on() ? sim_regs.portc.bits.RC6 : sim_regs.portb.bits.RB5;
+}
+
+static int left_forward_pin(void)
+{
+    return serial_on() ? sim_regs.portc.bits.RC7 : sim_regs.portb.bits.RB7;
+}
+
+static int led_pins(void)
+{
+    return sim_regs.portc.byte & (serial_on() ? 0x3F : 0xFF);
+}
+
+static int motor_drive(int forward, int reverse)
+{
+    if (forward && !reverse)
+    {
+        return 1;
+    }
+    else if (reverse && !forward)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void record_rest(void)
+{
+    struct SimResult *result = sim.result;
+    double button = sim.config.button_time;
+
+    if (result->rests < SIM_MAX_RESTS)
+    {
+        struct SimRest *rest = &result->rest[result->rests++];
+
+        rest->time = sim.last_moving - button;
+        rest->x = sim.x;
+        rest->y = sim.y;
+        rest->zone = field_zone(sim.x, sim.y);
+
+        if (rest->zone >= ZONE_DEST0 && rest->zone <= ZONE_DEST3 && !result->delivered)
+        {
+            sim.visited |= 1 << (rest->zone - ZONE_DEST0);
+
+            if ((sim.visited & sim_stops(&sim.config)) == sim_stops(&sim.config))
+            {
+                result->delivered = 1;
+                result->delivered_time = rest->time;
+            }
+        }
+    }
+}
+
+// Moves the robot model on by PHYSICS_CYCLES. //
+static void step_physics(void)
+{
+    double dt = PHYSICS_CYCLES / CYCLES_PER_SECOND;
+    double now = sim_time();
+    int right = motor_drive(sim_regs.portb.bits.RB4, right_reverse_pin());
+    int left = motor_drive(left_forward_pin(), sim_regs.portb.bits.RB6);
+    double speed;
+    double turn;
+    double angle;
+
+    sim.right_speed += (right * WHEEL_SPEED * sim.right_gain - sim.right_speed) * dt / MOTOR_LAG;
+    sim.left_speed += (left * WHEEL_SPEED * sim.left_gain - sim.left_speed) * dt / MOTOR_LAG;
+
+    speed = (sim.right_speed + sim.left_speed) / 2;
+    turn = (sim.right_speed - sim.left_speed) / WHEEL_BASE;
+    angle = sim.heading * M_PI / 180.0 + turn * dt / 2;
+
+    sim.x += speed * cos(angle) * dt;
+    sim.y += speed * sin(angle) * dt;
+    sim.heading += turn * dt * 180.0 / M_PI;
+
+    if (now >= sim.config.button_time && phase < SIM_PHASES)
+    {
+        sim.result->phase_time[phase] += dt;
+    }
+
+    if (phase != 0 && phase < SIM_PHASES)
+    {
+        sim.result->last_phase = phase;
+    }
+
+    // The robot shows other things on PORTC once it is idle again. //
+    if (phase == SIM_SCANNING || phase == SIM_DELIVERING)
+    {
+        sim.result->decoded = led_pins();
+    }
+
+    if (phase == SIM_DELIVERING && led_pins() < 4)
+    {
+        sim.result->shown |= 1 << led_pins();
+    }
+
+    // The start button is held down for a moment once the program has booted. //
+    sim_regs.porta.bits.RA5 = (now >= sim.config.button_time && now < sim.config.button_time + BUTTON_HOLD);
+
+    if (right != 0 || left != 0)
+    {
+        sim.moved = 1;
+        sim.last_moving = now;
+        sim.resting = 0;
+    }
+    else if (sim.moved && !sim.resting && now - sim.last_moving >= REST_TIME)
+    {
+        sim.resting = 1;
+        record_rest();
+    }
+
+    if (sim.moved && now - sim.last_moving >= FINISH_TIME)
+    {
+        sim.result->completed = 1;
+        sim.finished = 1;
+    }
+    else if (now - sim.config.button_time >= sim.config.time_limit)
+    {
+        sim.finished = 1;
+    }
+}
+
+static void write_trace(void)
+{
+    fprintf(sim.trace, "%.3f,%.1f,%.1f,%.1f,%d,%d,%d,%d%d%d%d,%d\n",
+            sim_time(), sim.x, sim.y, sim.heading,
+            sim.reading[1] / 4, sim.reading[3] / 4, sim.reading[2] / 4,
+            sim_regs.portb.bits.RB4, right_reverse_pin(), sim_regs.portb.bits.RB6, left_forward_pin(),
+            led_pins());
+}
+
+// Voltage of CVREF as a fraction of the supply, or 0 while it is off for C1. //
+static double reference_level(void)
+{
+    int step = sim_regs.vrcon & 0x0F;
+
+    if (!(sim_regs.vrcon & 0x80))
+    {
+        return 0;
+    }
+
+    return (sim_regs.vrcon & 0x20) ? step / 24.0 : 0.25 + step / 32.0;
+}
+
+// Compares the sensor on C12IN0- with CVREF, or with C1IN+ which nothing drives, flagging a change of the output. //
+static void run_comparator(void)
+{
+    union SimCM1CON0 control = sim_regs.cm1con0;
+    double input;
+    int output;
+
+    if (!control.bits.C1ON)
+    {
+        return;
+    }
+
+    input = (control.bits.C1CH == 0) ? channel_reading(1) / 1023.0 : 0;
+    output = ((control.bits.C1R ? reference_level() : 0) > input) ^ control.bits.C1POL;
+
+    if (output != control.bits.C1OUT)
+    {
+        sim_regs.cm1con0.bits.C1OUT = output;
+        sim_regs.pir2.bits.C1IF = 1;
+    }
+}
+
+// Runs the robot model up to the current cycle. The comparator follows the sensor as the model moves it. //
+static void run_model(void)
+{
+    while (sim.cycles >= sim.next_physics)
+    {
+        step_physics();
+        run_comparator();
+        sim.next_physics += PHYSICS_CYCLES;
+    }
+
+    if (sim.trace && sim.cycles >= sim.next_trace)
+    {
+        write_trace();
+        sim.next_trace += TRACE_CYCLES;
+    }
+}
+
+// Runs the peripherals up to the current cycle. //
+static void run_peripherals(void)
+{
+    if (sim_regs.adcon0.bits.CHS != sim.adc_channel)
+    {
+        sim.adc_channel = sim_regs.adcon0.bits.CHS;
+        sim.adc_settled = sim.cycles;
+    }
+
+    // The hold capacitor is disconnected at GO, short of the new channel if it had less than the acquisition time. //
+    if (sim_regs.adcon0.bits.GO && sim_regs.adcon0.bits.ADON && !sim.adc_busy)
+    {
+        double target = channel_reading(sim.adc_channel);
+
+        sim.adc_hold = target + (sim.adc_hold - target) * exp(-(double)(sim.cycles - sim.adc_settled) / ACQUISITION_TAU);
+        sim.adc_busy = 1;
+        sim.adc_done = sim.cycles + 11 * adc_period() + 1;
+        sim.result->conversions++;
+        profile_conversion();
+    }
+
+    if (sim.adc_busy && sim.cycles >= sim.adc_done)
+    {
+        int channel = sim.adc_channel;
+        int value = (int)(sim.adc_hold + 0.5);
+
+        sim.reading[channel] = value;
+        sim.adc_settled = sim.cycles; // Connected to the channel again.
+
+        if (sim_regs.adcon0.bits.ADFM)
+        {
+            sim_regs.adresh = value >> 8;
+            sim_regs.adresl = value & 0xFF;
+        }
+        else
+        {
+            sim_regs.adresh = value >> 2;
+            sim_regs.adresl = (value & 3) << 6;
+        }
+
+        sim.adc_busy = 0;
+        sim_regs.adcon0.bits.GO = 0;
+        sim_regs.pir1.bits.ADIF = 1;
+    }
+
+    if (sim_regs.t1con.bits.TMR1ON && !sim_regs.t1con.bits.TMR1CS)
+    {
+        unsigned long prescale = 1UL << sim_regs.t1con.bits.T1CKPS;
+        unsigned long long count;
+
+        if (!sim.timer1_running)
+        {
+            sim.timer1_running = 1;
+            sim.timer1_start = sim.cycles - ((sim_regs.tmr1h << 8) | sim_regs.tmr1l) * prescale;
+        }
+
+        count = (sim.cycles - sim.timer1_start) / prescale;
+
+        if (count >= 0x10000)
+        {
+            sim_regs.pir1.bits.TMR1IF = 1;
+            sim.timer1_start += (count & ~0xFFFFULL) * prescale;
+            count &= 0xFFFF;
+        }
+
+        sim_regs.tmr1h = count >> 8;
+        sim_regs.tmr1l = count & 0xFF;
+    }
+    else
+    {
+        sim.timer1_running = 0;
+    }
+
+    if (serial_on() && (sim_regs.txsta & 0x20))
+    {
+        if (sim.tx_busy && sim.cycles >= sim.tx_done)
+        {
+            sim.tx_busy = 0;
+            sim.result->serial_bytes++;
+
+            if (sim.telemetry)
+            {
+                fputc(sim.tx_shift, sim.telemetry);
+            }
+        }
+
+        if (!sim.tx_busy && !(sim_regs.txreg & 0x100))
+        {
+            sim.tx_busy = 1;
+            sim.tx_shift = sim_regs.txreg;
+            sim.tx_done = sim.cycles + 10 * serial_bit_period(); // Start bit, 8 data bits and stop bit.
+            sim_regs.txreg = 0x100;
+        }
+
+        sim_regs.pir1.bits.TXIF = (sim_regs.txreg & 0x100) != 0;
+        sim_regs.txsta = (sim_regs.txsta & ~0x02) | (sim.tx_busy ? 0 : 0x02); // TRMT.
+    }
+
+    if (sim_regs.t2con.bits.TMR2ON)
+    {
+        if (!sim.tick_running)
+        {
+            sim.tick_running = 1;
+            sim.next_tick = sim.cycles + tick_period();
+        }
+        else if (sim.cycles >= sim.next_tick)
+        {
+            sim_regs.pir1.bits.TMR2IF = 1;
+            sim.next_tick += tick_period();
+        }
+    }
+    else
+    {
+        sim.tick_running = 0;
+    }
+
+    run_model();
+}
+
+static int interrupt_pending(void)
+{
+    union SimINTCON intcon = sim_regs.intcon;
+    union SimPIR1 pir1 = sim_regs.pir1;
+    union SimPIE1 pie1 = sim_regs.pie1;
+
+    if (!intcon.bits.GIE)
+    {
+        return 0;
+    }
+
+    if (intcon.bits.RABIF && intcon.bits.RABIE)
+    {
+        return 1;
+    }
+
+    if (!intcon.bits.PEIE)
+    {
+        return 0;
+    }
+
+    return (pir1.bits.ADIF && pie1.bits.ADIE) || (pir1.bits.TMR1IF && pie1.bits.TMR1IE) || (pir1.bits.TMR2IF && pie1.bits.TMR2IE) ||
+           (pir1.bits.TXIF && pie1.bits.TXIE) || (sim_regs.pir2.bits.C1IF && sim_regs.pie2.bits.C1IE);
+}
+
+/* ================================
+Function: sim_cycle
+Paramaters: unsigned long cycles
+return type: none
+Description: Lets the number of
+instruction cycles given pass. Runs
+the peripherals and the robot model,
+then the interrupt handler if an
+enabled interrupt is pending.
+================================ */
+void sim_cycle(unsigned long cycles)
+{
+    sim.cycles += cycles;
+
+    run_peripherals();
+
+    if (sim.finished)
+    {
+        longjmp(sim.exit, 1);
+    }
+
+    while (!sim.in_isr && interrupt_pending())
+    {
+        sim.in_isr = 1;
+        sim_regs.intcon.bits.GIE = 0;
+        sim.cycles += ISR_CYCLES;
+
+        isr();
+
+        sim_regs.intcon.bits.GIE = 1;
+        sim.in_isr = 0;
+    }
+}
+
+/* ================================
+Function: sim_delay
+Paramaters: unsigned long cycles
+return type: none
+Description: Stands in for _delay().
+Lets the cycles given pass in small
+steps so interrupts are still taken
+on time.
+================================ */
+void sim_delay(unsigned long cycles)
+{
+    sim.result->delay_time += cycles / CYCLES_PER_SECOND;
+    profile_delay(cycles / CYCLES_PER_SECOND);
+
+    while (cycles > DELAY_CYCLES)
+    {
+        sim_cycle(DELAY_CYCLES);
+        cycles -= DELAY_CYCLES;
+    }
+
+    sim_cycle(cycles);
+}
+
+/* ================================
+Function: sim_nop
+Paramaters: none
+return type: none
+Description: Stands in for NOP(),
+which the firmware only uses to busy
+wait, so the cycle is counted as
+spin time.
+================================ */
+void sim_nop(void)
+{
+    sim.result->spin_time += 1 / CYCLES_PER_SECOND;
+    profile_spin();
+    sim_cycle(1);
+}
+
+/* ================================
+Function: sim_sleep
+Paramaters: none
+return type: none
+Description: Stands in for SLEEP().
+The instruction clock stops, so
+Timer1, Timer2 and the EUSART stand
+still and the conversion in progress
+is abandoned, while the robot model
+and an EEPROM write carry on. Wakes
+when the start button changes with
+RABIE and IOCA set, or when the
+watchdog times out with SWDTEN set.
+The watchdog is only modelled here,
+since robot.c only runs it asleep.
+================================ */
+void sim_sleep(void)
+{
+    unsigned long long start;
+    unsigned long long timeout;
+    int button = sim_regs.porta.bits.RA5;
+
+    sim_cycle(1);
+
+    // A wake that is already pending makes SLEEP a NOP. //
+    if (sim_regs.intcon.bits.RABIF && sim_regs.intcon.bits.RABIE)
+    {
+        return;
+    }
+
+    sim.adc_busy = 0;
+    sim_regs.adcon0.bits.GO = 0;
+
+    start = sim.cycles;
+    timeout = (32UL << ((sim_regs.wdtcon >> 1) & 0x0F)) / LFINTOSC * CYCLES_PER_SECOND;
+
+    while (1)
+    {
+        sim.cycles = sim.next_physics;
+        run_model();
+
+        if (sim.finished)
+        {
+            break;
+        }
+
+        if (sim_regs.intcon.bits.RABIE && (sim_regs.ioca & 0x20) && sim_regs.porta.bits.RA5 != button)
+        {
+            sim_regs.intcon.bits.RABIF = 1;
+            break;
+        }
+
+        if ((sim_regs.wdtcon & 0x01) && sim.cycles - start >= timeout)
+        {
+            break;
+        }
+    }
+
+    // The clocked peripherals pick up where they stopped. //
+    sim.next_tick += sim.cycles - start;
+    sim.timer1_start += sim.cycles - start;
+    sim.tx_done += sim.cycles - start;
+    sim.result->sleep_time += (sim.cycles - start) / CYCLES_PER_SECOND;
+    profile_sleep((sim.cycles - start) / CYCLES_PER_SECOND);
+
+    sim_cycle(1);
+}
+
+// Waits for the EEPROM write in progress to finish, as the library functions do. //
+static void eeprom_wait(void)
+{
+    while (sim.cycles < sim.eeprom_done)
+    {
+        sim_nop();
+    }
+}
+
+/* ================================
+Function: sim_eeprom_read
+Paramaters: unsigned char address
+return type: unsigned char
+Description: Stands in for
+eeprom_read().
+================================ */
+unsigned char sim_eeprom_read(unsigned char address)
+{
+    eeprom_wait();
+    sim_cycle(4);
+
+    return sim.eeprom[address];
+}
+
+/* ================================
+Function: sim_eeprom_write
+Paramaters: unsigned char address, unsigned char value
+return type: none
+Description: Stands in for
+eeprom_write(). The write carries on
+in the background, so only the next
+EEPROM access has to wait for it.
+================================ */
+void sim_eeprom_write(unsigned char address, unsigned char value)
+{
+    eeprom_wait();
+    sim_cycle(10);
+
+    sim.eeprom[address] = value;
+    sim.eeprom_done = sim.cycles + EEPROM_CYCLES;
+    sim.result->eeprom_writes++;
+}
+
+/* ================================
+Function: sim_stops
+Paramaters: const struct SimConfig *config
+return type: int
+Description: Returns the mask of
+destinations the barcode of the run
+given encodes.
+================================ */
+int sim_stops(const struct SimConfig *config)
+{
+    return (1 << config->destination) | config->extra_stops;
+}
+
+/* ================================
+Function: sim_default_config
+Paramaters: struct SimConfig *config
+return type: none
+Description: Fills in a noisy but
+otherwise ideal run to destination 0.
+================================ */
+void sim_default_config(struct SimConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+
+    config->destination = 0;
+    config->seed = 1;
+    config->sensor_noise = 1.0;
+    config->light_offset = 0.0;
+    config->motor_mismatch = 0.0;
+    config->speed_scale = 1.0;
+    config->button_time = 2.0;
+    config->time_limit = 120.0;
+    config->trace_path = NULL;
+    config->telemetry_path = NULL;
+    config->eeprom_path = NULL;
+    config->profile_path = NULL;
+}
+
+// Runs one mission in this process, robot.c's globals must still hold their power up values. //
+static void run_mission(const struct SimConfig *config, struct SimResult *result)
+{
+    clock_t started = clock();
+
+    memset(&sim, 0, sizeof(sim));
+    memset(&sim_regs, 0, sizeof(sim_regs));
+    memset(result, 0, sizeof(*result));
+
+    sim.config = *config;
+    sim.result = result;
+    sim.random = config->seed * 2685821657736338717ULL + 1;
+    sim.next_physics = PHYSICS_CYCLES;
+    sim_regs.txreg = 0x100;
+    sim.right_gain = (1.0 + config->motor_mismatch / 2) * config->speed_scale;
+    sim.left_gain = (1.0 - config->motor_mismatch / 2) * config->speed_scale;
+
+    memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+
+    if (config->eeprom_path)
+    {
+        FILE *image = fopen(config->eeprom_path, "rb");
+
+        if (image)
+        {
+            if (fread(sim.eeprom, 1, sizeof(sim.eeprom), image) != sizeof(sim.eeprom))
+            {
+                memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+            }
+
+            fclose(image);
+        }
+    }
+
+    field_build(sim_stops(config));
+    field_start_pose(&sim.x, &sim.y, &sim.heading);
+    sim.x += config->start_x;
+    sim.y += config->start_y;
+    sim.heading += config->start_heading;
+
+    if (config->trace_path)
+    {
+        sim.trace = fopen(config->trace_path, "w");
+
+        if (sim.trace)
+        {
+            fprintf(sim.trace, "time,x,y,heading,right_sensor,centre_sensor,left_sensor,motors,portc\n");
+        }
+    }
+
+    if (config->telemetry_path)
+    {
+        sim.telemetry = fopen(config->telemetry_path, "wb");
+    }
+
+    if (setjmp(sim.exit) == 0)
+    {
+        robot_main();
+    }
+
+    if (sim.trace)
+    {
+        fclose(sim.trace);
+    }
+
+    if (sim.telemetry)
+    {
+        fclose(sim.telemetry);
+    }
+
+    if (config->eeprom_path)
+    {
+        FILE *image = fopen(config->eeprom_path, "wb");
+
+        if (image)
+        {
+            fwrite(sim.eeprom, 1, sizeof(sim.eeprom), image);
+            fclose(image);
+        }
+    }
+
+    if (config->profile_path)
+    {
+        profile_report(config->profile_path);
+    }
+
+    result->timed = latency_counts != NULL;
+
+    if (result->timed)
+    {
+        for (int i = 0; i < SIM_LATENCY_BUCKETS; i++)
+        {
+            result->latency_counts[i] = latency_counts[i];
+        }
+
+        for (int i = 0; i < SIM_PHASES; i++)
+        {
+            result->latency_max[i] = (latency_max[i] << SIM_LATENCY_MAX_SHIFT) / CYCLES_PER_SECOND; // Timer1 counts instruction cycles.
+        }
+
+        result->latency_overruns = latency_overruns;
+    }
+    result->mission_time = sim.last_moving - config->button_time;
+    result->returned = result->completed && field_zone(sim.x, sim.y) == ZONE_HOME;
+    result->host_time = (double)(clock() - started) / CLOCKS_PER_SEC;
+}
+
+/* ================================
+Function: sim_run
+Paramaters: const struct SimConfig *config, struct SimResult *result
+return type: int
+Description: Powers up the robot on
+the field and runs robot.c until it
+stops for good or runs out of time.
+Every run is made in a child process
+so it starts from the initial values
+of the firmware's variables, as after
+a real reset. Returns 1 if the robot
+delivered to every destination of
+the barcode, showing each of them,
+and got home.
+================================ */
+int sim_run(const struct SimConfig *config, struct SimResult *result)
+{
+    int pipe_ends [2];
+    pid_t child;
+    size_t received = 0;
+
+    fflush(NULL);
+
+    if (pipe(pipe_ends) != 0 || (child = fork()) < 0)
+    {
+        perror("sim_run");
+        exit(1);
+    }
+
+    if (child == 0)
+    {
+        close(pipe_ends[0]);
+        run_mission(config, result);
+
+        if (write(pipe_ends[1], result, sizeof(*result)) != (ssize_t)sizeof(*result))
+        {
+            _exit(1);
+        }
+
+        _exit(0);
+    }
+
+    close(pipe_ends[1]);
+    memset(result, 0, sizeof(*result));
+
+    while (received < sizeof(*result))
+    {
+        ssize_t count = read(pipe_ends[0], (char *)result + received, sizeof(*result) - received);
+
+        if (count <= 0)
+        {
+            break;
+        }
+
+        received += count;
+    }
+
+    close(pipe_ends[0]);
+    waitpid(child, NULL, 0);
+
+    if (received < sizeof(*result))
+    {
+        fprintf(stderr, "sim_run: mission to destination %d crashed\n", config->destination);
+        memset(result, 0, sizeof(*result));
+        return 0;
+    }
+
+    return result->completed && result->shown == sim_stops(config) && result->delivered && result->returned;
+}
@@ -0,0 +1,94 @@
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Program: sim.h
+Description: Interface of the host
+simulator that runs robot.c against
+a model of the playing field.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#define SIM_MAX_RESTS 32
+#define SIM_PHASES    7  // Phases of the mission, numbered as enum Phase in robot.c.
+#define SIM_SCANNING  4  // Phases the destination is shown on PORTC in.
+#define SIM_DELIVERING 5
+#define SIM_LATENCY_BUCKETS 8 // Buckets of the step time histogram, LATENCY_BUCKETS in robot.c.
+#define SIM_LATENCY_MAX_SHIFT 3 // Shift the longest steps are kept at, LATENCY_MAX_SHIFT in robot.c.
+
+enum SimZone {ZONE_NONE, ZONE_HOME, ZONE_BARCODE, ZONE_DEST0, ZONE_DEST1, ZONE_DEST2, ZONE_DEST3};
+
+struct SimConfig
+{
+    int destination;           // Destination encoded by the barcode, 0 to 3.
+    int extra_stops;           // Mask of further destinations the barcode encodes, bit i for destination i.
+    unsigned long seed;        // Seed for the sensor noise.
+    double sensor_noise;       // Standard deviation of each reading in 8 bit ADC counts.
+    double light_offset;       // Ambient light added to every reading in 8 bit ADC counts.
+    double motor_mismatch;     // Fraction the right motor runs faster than the left one.
+    double speed_scale;        // Wheel speed at full duty and supply voltage relative to a fresh battery.
+    double start_x;            // Offset of the start position in mm.
+    double start_y;
+    double start_heading;      // Offset of the start heading in degrees.
+    double button_time;        // Time in s the start button is pressed.
+    double time_limit;         // Time in s the mission is abandoned.
+    const char *trace_path;    // CSV file the robot state is written to every 10ms, or NULL.
+    const char *telemetry_path; // File the bytes sent by the EUSART are written to, or NULL.
+    const char *eeprom_path;   // File the data EEPROM is loaded from and saved to after the run, or NULL for erased.
+    const char *profile_path;  // File the profile of robot.c is written to after the run, or NULL.
+};
+
+struct SimRest
+{
+    double time;               // Time in s after the button press the robot came to rest.
+    double x;
+    double y;
+    int zone;                  // enum SimZone the robot rested in.
+};
+
+struct SimResult
+{
+    int completed;             // Robot stopped for good before the time limit.
+    int decoded;               // Destination last shown on PORTC while scanning or delivering.
+    int shown;                 // Mask of the destinations shown on PORTC while delivering.
+    int delivered;             // Robot rested in every destination section.
+    int returned;              // Robot ended the run in the home section.
+    double delivered_time;     // Time in s after the button press the robot docked at the last destination.
+    double mission_time;       // Time in s after the button press the robot stopped for good.
+    double host_time;          // Wall clock time in s the run took on the host.
+    unsigned long conversions; // ADC conversions started by the firmware.
+    double phase_time [SIM_PHASES]; // Time in s spent in each phase after the button press.
+    int last_phase;            // Last phase other than waiting the robot was in, where a failed mission went wrong.
+    double delay_time;         // Time in s spent in _delay().
+    double spin_time;          // Time in s spent in NOP() busy waits.
+    double sleep_time;         // Time in s the PIC slept.
+    int timed;                 // Set if robot.c was built with LATENCY_HISTOGRAM, so the step times below are valid.
+    unsigned long latency_counts [SIM_LATENCY_BUCKETS]; // Control ticks per step time bucket from robot.c, halved together whenever one filled.
+    double latency_max [SIM_PHASES]; // Longest step of each phase in s.
+    unsigned int latency_overruns; // Steps that ran into the next tick.
+    int eeprom_writes;         // EEPROM bytes written by the firmware.
+    unsigned long serial_bytes; // Bytes sent by the EUSART.
+    int rests;
+    struct SimRest rest [SIM_MAX_RESTS];
+};
+
+// SIMULATOR FUNCTIONS //
+void sim_default_config(struct SimConfig *config);
+int sim_run(const struct SimConfig *config, struct SimResult *result);
+int sim_stops(const struct SimConfig *config);
+double sim_time(void);
+
+// FIELD FUNCTIONS //
+void field_build(int stops);
+double field_reflectance(double x, double y, double size);
+int field_zone(double x, double y);
+void field_start_pose(double *x, double *y, double *heading);
+const char *field_zone_name(int zone);
+
+// PROFILER FUNCTIONS //
+void profile_conversion(void);
+void profile_spin(void);
+void profile_delay(double time);
+void profile_sleep(double time);
+void profile_report(const char *path);
+
+#endif